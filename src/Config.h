@@ -100,6 +100,37 @@
 #define SQL_DEFAULT_SWEEP_INTERVAL 60
 
 
+/**
+ * The interval in seconds between runs of the adaptive pool sizing controller
+ */
+#define SQL_DEFAULT_ADAPT_INTERVAL 5
+
+
+/**
+ * The number of points each shard is placed at on the ShardRouter hash ring
+ */
+#define SQL_DEFAULT_SHARD_POINTS 160
+
+
+/**
+ * The interval in seconds between health checks of read replicas
+ */
+#define SQL_DEFAULT_HEALTH_INTERVAL 5
+
+
+/**
+ * The maximum number of batch rows sent in a pipeline before reading results
+ */
+#define SQL_DEFAULT_PIPELINE_DEPTH 256
+
+
+/**
+ * The maximum number of threads used to open initial connections concurrently
+ * in ConnectionPool_start()
+ */
+#define SQL_DEFAULT_FILL_THREADS 8
+
+
 /**
  * Default Connection timeout in seconds, used by reaper to remove
  * inactive connections
@@ -164,6 +195,16 @@
 #define IS      Str_isEqual
 
 
+#ifndef MIN
+#define MIN(x, y) ((x) < (y) ? (x) : (y))
+#endif
+
+
+#ifndef MAX
+#define MAX(x, y) ((x) > (y) ? (x) : (y))
+#endif
+
+
 /* ------------------------------------------------------ Type definitions */
 
 
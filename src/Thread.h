@@ -67,5 +67,6 @@
 #define ThreadData_create(key, dtor) wrapper(pthread_key_create(&(key), dtor))
 #define ThreadData_set(key, value) pthread_setspecific((key), (value))
 #define ThreadData_get(key) pthread_getspecific((key))
+#define ThreadData_delete(key) wrapper(pthread_key_delete(key))
 
 #endif
@@ -28,6 +28,8 @@
 
 #include <stdio.h>
 #include <stdarg.h>
+#include <string.h>
+#include <stdatomic.h>
 
 #include "URL.h"
 #include "Vector.h"
@@ -78,21 +80,40 @@ static const struct Cop_T *cops[] = {
         NULL
 };
 
+/* A cached PreparedStatement, see ConnectionPool_setStatementCacheSize(), or a statement registered with ConnectionPool_registerStatement() */
+typedef struct statement_t {
+        char *sql;
+        bool inUse;
+        atomic_bool prepared; // A registered statement is prepared, read by ConnectionPool_prepared() from other threads
+        PreparedStatement_T p;
+} *statement_t;
+
 #define T Connection_T
 struct Connection_S {
         Cop_T op;
         URL_T url;
+        int index;
         int maxRows;
         int fetchSize;
-        bool isAvailable;
+        atomic_bool isAvailable;
         int queryTimeout;
+        int appliedTimeout;
+        bool stateInTransaction;
         Vector_T prepared;
+        Vector_T cache;
+        int cacheSize;
+        Vector_T registered;
         int isInTransaction;
         int fetchSizeDefault;
-        time_t lastAccessedTime;
+        atomic_llong lastAccessedTime;
+        long long expiryTime;
+        long long checkoutTime;
+        int priority;
+        int tenant;
         ResultSet_T resultSet;
         ConnectionDelegate_T D;
         ConnectionPool_T parent;
+        T next;
 };
 
 
@@ -126,6 +147,129 @@ static void _freePrepared(T C) {
 }
 
 
+static void _freeStatement(statement_t *s) {
+        PreparedStatement_free(&(*s)->p);
+        FREE((*s)->sql);
+        FREE(*s);
+}
+
+
+/* Reset cached PreparedStatements for the next checkout. A statement which cannot be reset is closed */
+static void _resetCache(T C) {
+        for (int i = Vector_size(C->cache) - 1; i >= 0; i--) {
+                statement_t s = Vector_get(C->cache, i);
+                if (s->inUse) {
+                        s->inUse = false;
+                        if (! PreparedStatement_clear(s->p)) {
+                                Vector_remove(C->cache, i);
+                                _freeStatement(&s);
+                        }
+                }
+        }
+}
+
+
+/* Reset registered PreparedStatements handed out during the checkout. A statement which cannot be reset is prepared again when needed */
+static void _resetRegistered(T C) {
+        for (int i = 0; i < Vector_size(C->registered); i++) {
+                statement_t s = Vector_get(C->registered, i);
+                if (s->inUse) {
+                        s->inUse = false;
+                        if (! PreparedStatement_clear(s->p)) {
+                                atomic_store(&s->prepared, false);
+                                PreparedStatement_free(&s->p);
+                        }
+                }
+        }
+}
+
+
+/* Find a cached PreparedStatement not already handed out during this checkout and make it the most recently used */
+static PreparedStatement_T _getCached(T C, const char *sql) {
+        for (int i = Vector_size(C->cache) - 1; i >= 0; i--) {
+                statement_t s = Vector_get(C->cache, i);
+                if (! s->inUse && Str_isEqual(s->sql, sql)) {
+                        Vector_remove(C->cache, i);
+                        Vector_push(C->cache, s);
+                        s->inUse = true;
+                        return s->p;
+                }
+        }
+        return NULL;
+}
+
+
+/* Cache a new PreparedStatement, evicting the least recently used statement not in use. Returns false if the cache is full of statements in use */
+static bool _cache(T C, char *sql, PreparedStatement_T p) {
+        if (Vector_size(C->cache) >= C->cacheSize) {
+                int i = 0;
+                while (i < Vector_size(C->cache) && ((statement_t)Vector_get(C->cache, i))->inUse)
+                        i++;
+                if (i == Vector_size(C->cache))
+                        return false;
+                statement_t evicted = Vector_remove(C->cache, i);
+                _freeStatement(&evicted);
+        }
+        statement_t s;
+        NEW(s);
+        s->sql = sql;
+        s->p = p;
+        s->inUse = true;
+        Vector_push(C->cache, s);
+        return true;
+}
+
+
+static PreparedStatement_T _prepare(T C, const char *sql, ...) {
+        va_list ap;
+        va_start(ap, sql);
+        PreparedStatement_T p = C->op->prepareStatement(C->D, sql, ap);
+        va_end(ap);
+        return p;
+}
+
+
+static bool _execute(T C, const char *sql, ...) {
+        va_list ap;
+        va_start(ap, sql);
+        bool success = C->op->execute(C->D, sql, ap);
+        va_end(ap);
+        return success;
+}
+
+
+static ResultSet_T _executeQuery(T C, const char *sql, ...) {
+        va_list ap;
+        va_start(ap, sql);
+        ResultSet_T r = C->op->executeQuery(C->D, sql, ap);
+        va_end(ap);
+        return r;
+}
+
+
+/* The *_n methods fall back to "%.*s" formatting for drivers without a length-aware operation */
+static PreparedStatement_T _prepare_n(T C, const char *sql, size_t len) {
+        if (C->op->prepareStatement_n)
+                return C->op->prepareStatement_n(C->D, sql, len);
+        return _prepare(C, "%.*s", (int)len, sql);
+}
+
+
+/* Prepare or reuse a cached PreparedStatement for key. Takes ownership of key */
+static PreparedStatement_T _prepareCached(T C, char *key) {
+        PreparedStatement_T p;
+        if (! (p = _getCached(C, key)) && (p = _prepare_n(C, key, strlen(key)))) {
+                PreparedStatement_setConnection(p, C);
+                if (_cache(C, key, p))
+                        key = NULL;
+                else
+                        Vector_push(C->prepared, p);
+        }
+        FREE(key);
+        return p;
+}
+
+
 /* ----------------------------------------------------- Protected methods */
 
 
@@ -141,7 +285,10 @@ T Connection_new(void *pool, char **error) {
         C->isAvailable = true;
         C->isInTransaction = false;
         C->prepared = Vector_new(4);
-        C->lastAccessedTime = Time_now();
+        C->cacheSize = ConnectionPool_getStatementCacheSize(pool);
+        C->cache = Vector_new(C->cacheSize);
+        C->registered = Vector_new(0);
+        C->lastAccessedTime = Time_milli();
         C->url = ConnectionPool_getURL(pool);
         C->fetchSize = SQL_DEFAULT_PREFETCH_ROWS;
         if (! _setDelegate(C, error)) {
@@ -157,6 +304,18 @@ void Connection_free(T *C) {
         assert(C && *C);
         Connection_clear((*C));
         Vector_free(&((*C)->prepared));
+        while (! Vector_isEmpty((*C)->cache)) {
+                statement_t s = Vector_pop((*C)->cache);
+                _freeStatement(&s);
+        }
+        Vector_free(&((*C)->cache));
+        while (! Vector_isEmpty((*C)->registered)) {
+                statement_t s = Vector_pop((*C)->registered);
+                if (s->p)
+                        PreparedStatement_free(&s->p);
+                FREE(s);
+        }
+        Vector_free(&((*C)->registered));
         if ((*C)->D)
                 (*C)->op->free(&((*C)->D));
         FREE(*C);
@@ -166,7 +325,7 @@ void Connection_free(T *C) {
 void Connection_setAvailable(T C, int isAvailable) {
         assert(C);
         C->isAvailable = isAvailable;
-        C->lastAccessedTime = Time_now();
+        C->lastAccessedTime = Time_milli();
 }
 
 
@@ -176,7 +335,129 @@ bool Connection_isAvailable(T C) {
 }
 
 
+void Connection_setIndex(T C, int index) {
+        assert(C);
+        C->index = index;
+}
+
+
+int Connection_getIndex(T C) {
+        assert(C);
+        return C->index;
+}
+
+
+/*
+ * Session state such as the query timeout is sent to the database lazily, before the
+ * next statement and only if it differs from what the session already has. Setting
+ * it back and forth between statements, or resetting it when the Connection is 
+ * returned to the pool, costs no round trips
+ */
+void Connection_applyState(T C) {
+        assert(C);
+        if (C->queryTimeout != C->appliedTimeout) {
+                if (C->op->setQueryTimeout)
+                        C->op->setQueryTimeout(C->D, C->queryTimeout);
+                C->appliedTimeout = C->queryTimeout;
+                // A rollback may undo session state set in a transaction (PostgreSQL)
+                if (C->isInTransaction)
+                        C->stateInTransaction = true;
+        }
+}
+
+
+void Connection_registerStatement(T C, const char *sql) {
+        assert(C);
+        assert(sql);
+        statement_t s;
+        NEW(s);
+        s->sql = (char *)sql;
+        if ((s->p = _prepare_n(C, sql, strlen(sql)))) {
+                PreparedStatement_setConnection(s->p, C);
+                atomic_store(&s->prepared, true);
+        } else {
+                DEBUG("Failed to prepare registered statement '%s' -- %s\n", sql, Connection_getLastError(C));
+        }
+        Vector_push(C->registered, s);
+}
+
+
+bool Connection_isPrepared(T C, int handle) {
+        assert(C);
+        if (handle < 1 || handle > Vector_size(C->registered))
+                return false;
+        statement_t s = Vector_get(C->registered, handle - 1);
+        return atomic_load(&s->prepared);
+}
+
+
+void Connection_setNext(T C, T next) {
+        assert(C);
+        C->next = next;
+}
+
+
+T Connection_getNext(T C) {
+        assert(C);
+        return C->next;
+}
+
+
+void Connection_setPriority(T C, int priority) {
+        assert(C);
+        C->priority = priority;
+}
+
+
+int Connection_getPriority(T C) {
+        assert(C);
+        return C->priority;
+}
+
+
+void Connection_setTenant(T C, int tenant) {
+        assert(C);
+        C->tenant = tenant;
+}
+
+
+int Connection_getTenant(T C) {
+        assert(C);
+        return C->tenant;
+}
+
+
+void Connection_setExpiryTime(T C, long long expiryTime) {
+        assert(C);
+        C->expiryTime = expiryTime;
+}
+
+
+long long Connection_getExpiryTime(T C) {
+        assert(C);
+        return C->expiryTime;
+}
+
+
+void Connection_setCheckoutTime(T C, long long checkoutTime) {
+        assert(C);
+        C->checkoutTime = checkoutTime;
+}
+
+
+long long Connection_getCheckoutTime(T C) {
+        assert(C);
+        return C->checkoutTime;
+}
+
+
 time_t Connection_getLastAccessedTime(T C) {
+        assert(C);
+        return (time_t)(C->lastAccessedTime / MSEC_PER_SEC);
+}
+
+
+long long Connection_getLastAccessedMilli(T C) {
         assert(C);
         return C->lastAccessedTime;
 }
@@ -199,8 +480,6 @@ void Connection_setQueryTimeout(T C, int ms) {
         assert(C);
         assert(ms >= 0);
         C->queryTimeout = ms;
-        if (C->op->setQueryTimeout)
-                C->op->setQueryTimeout(C->D, ms);
 }
 
 
@@ -250,15 +529,24 @@ bool Connection_ping(T C) {
 }
 
 
+bool Connection_isAlive(T C) {
+        assert(C);
+        if (C->op->isAlive && C->op->isAlive(C->D))
+                return true;
+        return C->op->ping(C->D);
+}
+
+
 void Connection_clear(T C) {
         assert(C);
         if (C->resultSet)
                 ResultSet_free(&C->resultSet);
         _freePrepared(C);
+        _resetCache(C);
+        _resetRegistered(C);
         // Set properties back to default values
         C->maxRows = 0;
-        if (C->queryTimeout != 0)
-                Connection_setQueryTimeout(C, 0);
+        C->queryTimeout = 0;
         C->fetchSize = C->fetchSizeDefault;
 }
 
@@ -281,6 +569,7 @@ void Connection_commit(T C) {
         assert(C);
         if (C->isInTransaction)
                 C->isInTransaction = 0;
+        C->stateInTransaction = false;
         // Even if we are not in a transaction, call the delegate anyway and propagate any errors
         if (! C->op->commit(C->D))
                 THROW(SQLException, "%s", Connection_getLastError(C));
@@ -294,6 +583,11 @@ void Connection_rollback(T C) {
                 Connection_clear(C);
                 C->isInTransaction = 0;
         }
+        if (C->stateInTransaction) {
+                // The session state is unknown, apply it again before the next statement
+                C->appliedTimeout = -1;
+                C->stateInTransaction = false;
+        }
         // Even if we are not in a transaction, call the delegate anyway and propagate any errors
         if (! C->op->rollback(C->D))
                 THROW(SQLException, "%s", Connection_getLastError(C));
@@ -317,6 +611,7 @@ void Connection_execute(T C, const char *sql, ...) {
         assert(sql);
         if (C->resultSet)
                 ResultSet_free(&C->resultSet);
+        Connection_applyState(C);
         va_list ap;
         va_start(ap, sql);
         int success = C->op->execute(C->D, sql, ap);
@@ -325,11 +620,23 @@ void Connection_execute(T C, const char *sql, ...) {
 }
 
 
+void Connection_execute_n(T C, const char *sql, size_t len) {
+        assert(C);
+        assert(sql);
+        if (C->resultSet)
+                ResultSet_free(&C->resultSet);
+        Connection_applyState(C);
+        bool success = C->op->execute_n ? C->op->execute_n(C->D, sql, len) : _execute(C, "%.*s", (int)len, sql);
+        if (! success) THROW(SQLException, "%s", Connection_getLastError(C));
+}
+
+
 ResultSet_T Connection_executeQuery(T C, const char *sql, ...) {
         assert(C);
         assert(sql);
         if (C->resultSet)
                 ResultSet_free(&C->resultSet);
+        Connection_applyState(C);
         va_list ap;
         va_start(ap, sql);
         C->resultSet = C->op->executeQuery(C->D, sql, ap);
@@ -340,21 +647,69 @@ ResultSet_T Connection_executeQuery(T C, const char *sql, ...) {
 }
 
 
+ResultSet_T Connection_executeQuery_n(T C, const char *sql, size_t len) {
+        assert(C);
+        assert(sql);
+        if (C->resultSet)
+                ResultSet_free(&C->resultSet);
+        Connection_applyState(C);
+        C->resultSet = C->op->executeQuery_n ? C->op->executeQuery_n(C->D, sql, len) : _executeQuery(C, "%.*s", (int)len, sql);
+        if (! C->resultSet)
+                THROW(SQLException, "%s", Connection_getLastError(C));
+        return C->resultSet;
+}
+
+
 PreparedStatement_T Connection_prepareStatement(T C, const char *sql, ...) {
         assert(C);
         assert(sql);
+        PreparedStatement_T p;
         va_list ap;
         va_start(ap, sql);
-        PreparedStatement_T p = C->op->prepareStatement(C->D, sql, ap);
+        if (C->cacheSize > 0) {
+                p = _prepareCached(C, Str_vcat(sql, ap));
+        } else if ((p = C->op->prepareStatement(C->D, sql, ap))) {
+                PreparedStatement_setConnection(p, C);
+                Vector_push(C->prepared, p);
+        }
         va_end(ap);
-        if (p)
+        if (! p)
+                THROW(SQLException, "%s", Connection_getLastError(C));
+        return p;
+}
+
+
+PreparedStatement_T Connection_prepareStatement_n(T C, const char *sql, size_t len) {
+        assert(C);
+        assert(sql);
+        PreparedStatement_T p;
+        if (C->cacheSize > 0) {
+                p = _prepareCached(C, Str_ndup(sql, (int)len));
+        } else if ((p = _prepare_n(C, sql, len))) {
+                PreparedStatement_setConnection(p, C);
                 Vector_push(C->prepared, p);
-        else
+        }
+        if (! p)
                 THROW(SQLException, "%s", Connection_getLastError(C));
         return p;
 }
 
 
+PreparedStatement_T Connection_getStatement(T C, int handle) {
+        assert(C);
+        assert(handle > 0 && handle <= Vector_size(C->registered));
+        statement_t s = Vector_get(C->registered, handle - 1);
+        if (! s->p) {
+                if (! (s->p = _prepare_n(C, s->sql, strlen(s->sql))))
+                        THROW(SQLException, "%s", Connection_getLastError(C));
+                PreparedStatement_setConnection(s->p, C);
+                atomic_store(&s->prepared, true);
+        }
+        s->inUse = true;
+        return s->p;
+}
+
+
 const char *Connection_getLastError(T C) {
         assert(C);
         const char *s = C->op->getLastError(C->D);
@@ -101,6 +101,140 @@ void Connection_setAvailable(T C, int isAvailable);
 bool Connection_isAvailable(T C);
 
 
+/**
+ * Set the position of this Connection in the parent pool's connection
+ * list. Used by the pool to remove a Connection in constant time.
+ * @param C A Connection object
+ * @param index The slot index of this Connection in the pool
+ */
+void Connection_setIndex(T C, int index);
+
+
+/**
+ * Get the position of this Connection in the parent pool's connection list.
+ * @param C A Connection object
+ * @return The slot index of this Connection in the pool
+ */
+int Connection_getIndex(T C);
+
+
+/**
+ * Link this Connection to the next Connection in an intrusive list. Used
+ * by the pool to return a Connection to its idle list without taking a lock
+ * @param C A Connection object
+ * @param next The next Connection in the list or NULL
+ */
+void Connection_setNext(T C, T next);
+
+
+/**
+ * Send session state changed on this Connection, such as the query 
+ * timeout, to the database if it differs from the state the session 
+ * already has. Called before a statement is executed
+ * @param C A Connection object
+ */
+void Connection_applyState(T C);
+
+
+/**
+ * Prepare a statement registered on the parent pool. Called for each 
+ * registered statement, in handle order, when the Connection is created.
+ * If the statement cannot be prepared now it is prepared on first use.
+ * @param C A Connection object
+ * @param sql The registered SQL statement, owned by the pool
+ * @see ConnectionPool_registerStatement
+ */
+void Connection_registerStatement(T C, const char *sql);
+
+
+/**
+ * Test if a registered statement is prepared on this Connection. 
+ * May be called from another thread than the one using the Connection
+ * @param C A Connection object
+ * @param handle The statement handle
+ * @return true if the statement is prepared, otherwise false
+ */
+bool Connection_isPrepared(T C, int handle);
+
+
+/**
+ * Get the next Connection in an intrusive list
+ * @param C A Connection object
+ * @return The next Connection in the list or NULL
+ */
+T Connection_getNext(T C);
+
+
+/**
+ * Set the priority class of the caller which checked out this Connection
+ * @param C A Connection object
+ * @param priority The Priority_T class of the caller
+ */
+void Connection_setPriority(T C, int priority);
+
+
+/**
+ * Get the priority class of the caller which checked out this Connection
+ * @param C A Connection object
+ * @return The Priority_T class of the caller
+ */
+int Connection_getPriority(T C);
+
+
+/**
+ * Set the tenant which checked out this Connection
+ * @param C A Connection object
+ * @param tenant The tenant id or 0 if the Connection was not checked out
+ * for a tenant
+ */
+void Connection_setTenant(T C, int tenant);
+
+
+/**
+ * Get the tenant which checked out this Connection
+ * @param C A Connection object
+ * @return The tenant id or 0 if the Connection was not checked out for a
+ * tenant
+ */
+int Connection_getTenant(T C);
+
+
+/**
+ * Set the time after which the pool retires this Connection. 
+ * @param C A Connection object
+ * @param expiryTime The expiry time in milliseconds since midnight, 
+ * January 1, 1970 GMT or 0 if the Connection does not expire
+ */
+void Connection_setExpiryTime(T C, long long expiryTime);
+
+
+/**
+ * Get the time after which the pool retires this Connection.
+ * @param C A Connection object
+ * @return The expiry time in milliseconds or 0 if the Connection 
+ * does not expire
+ */
+long long Connection_getExpiryTime(T C);
+
+
+/**
+ * Set the time this Connection was checked out from the pool. Used by
+ * the pool to measure how long the Connection is held
+ * @param C A Connection object
+ * @param checkoutTime The checkout time in microseconds since midnight,
+ * January 1, 1970 GMT
+ */
+void Connection_setCheckoutTime(T C, long long checkoutTime);
+
+
+/**
+ * Get the time this Connection was checked out from the pool.
+ * @param C A Connection object
+ * @return The checkout time in microseconds
+ */
+long long Connection_getCheckoutTime(T C);
+
+
 /**
  * Return the last time this Connection was accessed from the Connection Pool.
  * The time is returned as the number of seconds since midnight, January 1, 
@@ -112,6 +246,25 @@ bool Connection_isAvailable(T C);
 time_t Connection_getLastAccessedTime(T C);
 
 
+/**
+ * Return the last time this Connection was accessed from the Connection Pool
+ * in milliseconds since midnight, January 1, 1970 GMT.
+ * @param C A Connection object
+ * @return The last time (milliseconds) this Connection was accessed
+ */
+long long Connection_getLastAccessedMilli(T C);
+
+
+/**
+ * Test if this Connection is alive. A cheap test of the connection's socket,
+ * without a server round trip, is used if the driver supports it and a full
+ * Connection_ping() is only done if the socket looks suspicious.
+ * @param C A Connection object
+ * @return true if this Connection is alive otherwise false
+ */
+bool Connection_isAlive(T C);
+
+
 /**
  * Return true if this Connection is in a transaction that has not
  * been committed.
@@ -131,7 +284,10 @@ bool Connection_isInTransaction(T C);
  * SQL (select) statement to finish if the database is busy. If the limit is
  * exceeded, the statement will return immediately with an error.
  * The timeout is set per connection/session. Not all database systems
- * supports query timeout. The default is no query timeout.
+ * supports query timeout. The default is no query timeout. The timeout is
+ * sent to the database with the next statement executed and only if it 
+ * differs from the timeout already in effect, so setting the same timeout
+ * each time a connection is taken from the pool is free.
  * @param C A Connection object
  * @param ms The query timeout limit in milliseconds; zero means
  * there is no timeout limit. Zero is the default value.
@@ -300,6 +456,21 @@ long long Connection_rowsChanged(T C);
 void Connection_execute(T C, const char *sql, ...) __attribute__((format (printf, 2, 3)));
 
 
+/**
+ * Same as Connection_execute() except that the SQL is given with its 
+ * length and is sent to the database as is. The SQL is not formatted 
+ * and need not be NUL terminated. Use this method for large generated
+ * SQL statements, such as a bulk insert, to avoid formatting and copying
+ * the statement on each call.
+ * @param C A Connection object
+ * @param sql A SQL statement
+ * @param len The length of sql in bytes
+ * @exception SQLException If a database error occurs. 
+ * @see SQLException.h
+ */
+void Connection_execute_n(T C, const char *sql, size_t len);
+
+
 /**
  * Executes the given SQL statement, which returns a single ResultSet
  * object. You may <b>only</b> use one SQL statement with this method.
@@ -322,6 +493,21 @@ void Connection_execute(T C, const char *sql, ...) __attribute__((format (printf
 ResultSet_T Connection_executeQuery(T C, const char *sql, ...) __attribute__((format (printf, 2, 3)));
 
 
+/**
+ * Same as Connection_executeQuery() except that the SQL is given with
+ * its length and is sent to the database as is, without formatting.
+ * @param C A Connection object
+ * @param sql A SQL statement
+ * @param len The length of sql in bytes
+ * @return A ResultSet object that contains the data produced by the
+ * given query. 
+ * @exception SQLException If a database error occurs. 
+ * @see ResultSet.h
+ * @see SQLException.h
+ */
+ResultSet_T Connection_executeQuery_n(T C, const char *sql, size_t len);
+
+
 /**
  * Creates a PreparedStatement object for sending parameterized SQL 
  * statements to the database. The <code>sql</code> parameter may 
@@ -331,7 +517,10 @@ ResultSet_T Connection_executeQuery(T C, const char *sql, ...) __attribute__((fo
  * setXXX methods. Only <i>one</i> SQL statement may be used in the sql 
  * parameter, this in difference to Connection_execute() which may 
  * take several statements. A PreparedStatement "lives" until the 
- * Connection is returned to the Connection Pool. 
+ * Connection is returned to the Connection Pool, unless the pool caches
+ * PreparedStatements, in which case a statement prepared with the same
+ * SQL on a later checkout is reused. 
+ * See ConnectionPool_setStatementCacheSize(). 
  * @param C A Connection object
  * @param sql A single SQL statement that may contain one or more '?' 
  * IN parameter placeholders
@@ -344,6 +533,40 @@ ResultSet_T Connection_executeQuery(T C, const char *sql, ...) __attribute__((fo
 PreparedStatement_T Connection_prepareStatement(T C, const char *sql, ...) __attribute__((format (printf, 2, 3)));
 
 
+/**
+ * Same as Connection_prepareStatement() except that the SQL is given 
+ * with its length and is not formatted.
+ * @param C A Connection object
+ * @param sql A single SQL statement that may contain one or more '?' 
+ * IN parameter placeholders
+ * @param len The length of sql in bytes
+ * @return A new PreparedStatement object containing the pre-compiled
+ * SQL statement.
+ * @exception SQLException If a database error occurs. 
+ * @see PreparedStatement.h
+ * @see SQLException.h
+ */
+PreparedStatement_T Connection_prepareStatement_n(T C, const char *sql, size_t len);
+
+
+/**
+ * Returns the PreparedStatement for a statement registered on the pool 
+ * with ConnectionPool_registerStatement(). The statement is normally 
+ * prepared when the Connection is created, so no parsing or planning is
+ * done on the server when it is executed. The parameters of the statement
+ * are reset when the Connection is returned to the pool. During a checkout 
+ * the same PreparedStatement is returned for the same handle.
+ * @param C A Connection object
+ * @param handle The statement handle returned by 
+ * ConnectionPool_registerStatement()
+ * @return The PreparedStatement of the registered statement
+ * @exception SQLException If the statement was not prepared and preparing
+ * it failed
+ * @see ConnectionPool_registerStatement
+ */
+PreparedStatement_T Connection_getStatement(T C, int handle);
+
+
 /**
  * This method can be used to obtain a string describing the last
  * error that occurred. Inside a CATCH-block you can also find
@@ -43,6 +43,8 @@ typedef struct Cop_T {
         T (*new)(Connection_T delegator, char **error);
         void (*free)(T *C);
         bool (*ping)(T C);
+        // Optional. Cheap liveness test without a server round trip, false if the connection looks broken
+        bool (*isAlive)(T C);
         void (*setQueryTimeout)(T C, int ms);
         bool (*beginTransaction)(T C);
         bool (*commit)(T C);
@@ -52,6 +54,10 @@ typedef struct Cop_T {
         bool (*execute)(T C, const char *sql, va_list ap);
         ResultSet_T (*executeQuery)(T C, const char *sql, va_list ap);
         PreparedStatement_T (*prepareStatement)(T C, const char *sql, va_list ap);
+        // Optional. Run SQL of the given length as is, without printf formatting
+        bool (*execute_n)(T C, const char *sql, size_t len);
+        ResultSet_T (*executeQuery_n)(T C, const char *sql, size_t len);
+        PreparedStatement_T (*prepareStatement_n)(T C, const char *sql, size_t len);
         const char *(*getLastError)(T C);
 } *Cop_T;
 
@@ -26,7 +26,14 @@
 #include "Config.h"
 
 #include <stdio.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <stddef.h>
 #include <string.h>
+#include <stdatomic.h>
+#ifdef HAVE_SCHED_GETCPU
+#include <sched.h>
+#endif
 
 #include "URL.h"
 #include "Thread.h"
@@ -48,23 +55,147 @@
 /* ----------------------------------------------------------- Definitions */
 
 
+/* A caller parked in ConnectionPool_getConnectionWithTimeout(). Lives on the caller's stack */
+typedef struct waiter_t {
+        Sem_T cond;
+        bool quota;
+        bool signaled;
+        long long since;
+        int tenant;
+        Priority_T priority;
+        Connection_T connection;
+        struct waiter_t *next;
+} *waiter_t;
+
+/* A tenant sharing the pool, see ConnectionPool_addTenant() */
+typedef struct tenant_t {
+        char *name;
+        int maxActive;
+        int minimum;
+        atomic_int active;
+        atomic_int peakActive;
+        atomic_llong checkouts;
+        atomic_llong rejected;
+} *tenant_t;
+
+/* Shared state for the threads opening initial connections in ConnectionPool_start() */
+typedef struct fill_t {
+        int next;
+        int created;
+        char *error;
+        long long connectTime;
+        long long maxConnectTime;
+        struct ConnectionPool_S *P;
+} *fill_t;
+
+/* Latency histogram, see Histogram_T */
+typedef struct histogram_t {
+        atomic_llong count;
+        atomic_llong sum;
+        atomic_llong buckets[SQL_HISTOGRAM_BUCKETS];
+} *histogram_t;
+
+/* Statistics counters. Kept per shard so threads on different CPUs do not update the same cache line */
+typedef struct counters_t {
+        atomic_llong checkouts;
+        atomic_llong returns;
+        atomic_llong creations;
+        atomic_llong creationFailures;
+        atomic_llong pingFailures;
+        atomic_llong reaped;
+        struct histogram_t checkoutWait;
+        struct histogram_t holdTime;
+        struct histogram_t connectTime;
+} *counters_t;
+
+/* A sub-pool of idle Connections with its own lock. See ConnectionPool_setShards() */
+typedef struct shard_t {
+        Mutex_T mutex;
+        Vector_T idle;
+        _Atomic(Connection_T) returned;
+        struct counters_t counters;
+} __attribute__ ((aligned (64))) *shard_t;
+
+/* A thread's parking slot for its last returned Connection. See ConnectionPool_setThreadAffinity() */
+typedef struct parked_t {
+        _Atomic(Connection_T) connection;
+        struct parked_t *next;
+        struct ConnectionPool_S *P;
+} *parked_t;
+
+/* Output state for ConnectionPool_renderMetrics() */
+typedef struct metrics_t {
+        int size;
+        int length;
+        char *buffer;
+        char labels[256];
+} *metrics_t;
+
 #define T ConnectionPool_T
 struct ConnectionPool_S {
         URL_T url;
         int filled;
         int doSweep;
+        int minIdle;
+        bool sweeping;
         char *error;
         Sem_T alarm;
 	Mutex_T mutex;
 	Vector_T pool;
+        shard_t shards;
+        int shardCount;
+        atomic_int idleCount;
+        bool affinity;
+        parked_t parked;
+        ThreadData_T parkedKey;
+        atomic_int parkedCount;
         Thread_T reaper;
+        int pending;
+        int reaping;
+        int replace;
+        int maxLifetime;
+        int reserved;
+        int statementCacheSize;
+        Vector_T statements;
+        atomic_int normalActive;
+        Vector_T tenants;
+        int guaranteed;
+        atomic_int sharedActive;
+        bool adaptive;
+        int target;
+        int waits;
+        long long adaptTime;
+        long long connectTime;
+        atomic_int peakActive;
+        atomic_int maxActive;
+        long long lastCheckouts;
+        long long lastReturns;
+        long long lastHoldTime;
+        Vector_T replicas;
+        long long healthTime;
+        atomic_bool healthy;
+        atomic_llong latency;
+        CircuitBreaker_T breaker;
+        int breakerThreshold;
+        int breakerBackoff;
+        int failures;
+        bool probing;
+        long long breakerTime;
+        atomic_int waiting;
+        waiter_t waiters;
+        waiter_t lastWaiter;
         int sweepInterval;
+        int validationWindow;
+        Validation_T validation;
 	int maxConnections;
         volatile int stopped;
         int connectionTimeout;
 	int initialConnections;
 };
 
+static atomic_int kThreadHint = 0;
+// Serializes a thread exit with the pool detaching its parked slots, see _unparkThread()
+static Mutex_T kParkedMutex = PTHREAD_MUTEX_INITIALIZER;
 int ZBDEBUG = false;
 #ifdef PACKAGE_PROTECTED
 #pragma GCC visibility push(hidden)
@@ -78,7 +209,160 @@ void(*AbortHandler)(const char *error) = NULL;
 /* ------------------------------------------------------- Private methods */
 
 
+static void _wakeWaiters(T P);
+
+
+/* Raise a high-water mark to value. A plain compare and store could lose a higher value stored concurrently */
+static inline void _atomicMax(atomic_int *max, int value) {
+        int current = atomic_load(max);
+        while (value > current && ! atomic_compare_exchange_weak(max, &current, value))
+                ;
+}
+
+
+static void _newShards(T P, int count) {
+        P->shardCount = count;
+        P->shards = CALLOC(count, sizeof (struct shard_t));
+        for (int i = 0; i < count; i++) {
+                Mutex_init(P->shards[i].mutex);
+                P->shards[i].idle = Vector_new(SQL_DEFAULT_MAX_CONNECTIONS / count + 1);
+        }
+}
+
+
+static void _freeShards(T P) {
+        for (int i = 0; i < P->shardCount; i++) {
+                Vector_free(&P->shards[i].idle);
+                Mutex_destroy(P->shards[i].mutex);
+        }
+        FREE(P->shards);
+}
+
+
+/* Returns the shard for the calling thread. The CPU the thread runs on if known, otherwise a per-thread shard */
+static inline int _getShard(T P) {
+        if (P->shardCount == 1)
+                return 0;
+#ifdef HAVE_SCHED_GETCPU
+        int cpu = sched_getcpu();
+        if (cpu >= 0)
+                return cpu % P->shardCount;
+#endif
+        static _Thread_local int hint = -1;
+        if (hint < 0)
+                hint = kThreadHint++;
+        return hint % P->shardCount;
+}
+
+
+#define COUNT(P, counter, n) atomic_fetch_add_explicit(&(P)->shards[_getShard(P)].counters.counter, (n), memory_order_relaxed)
+
+
+/* Bucket i counts samples up to 4^i microseconds, the last bucket counts all larger samples */
+static void _record(T P, size_t offset, long long us) {
+        int i = 0;
+        histogram_t h = (histogram_t)((char *)&P->shards[_getShard(P)].counters + offset);
+        for (long long bound = 1; i < SQL_HISTOGRAM_BUCKETS - 1 && us > bound; bound <<= 2)
+                i++;
+        atomic_fetch_add_explicit(&h->buckets[i], 1, memory_order_relaxed);
+        atomic_fetch_add_explicit(&h->count, 1, memory_order_relaxed);
+        atomic_fetch_add_explicit(&h->sum, us, memory_order_relaxed);
+}
+#define RECORD(P, histogram, us) _record((P), offsetof(struct counters_t, histogram), (us))
+
+
+static void _sumHistogram(Histogram_T *sum, histogram_t h) {
+        sum->count += atomic_load_explicit(&h->count, memory_order_relaxed);
+        sum->sum += atomic_load_explicit(&h->sum, memory_order_relaxed);
+        for (int i = 0; i < SQL_HISTOGRAM_BUCKETS; i++)
+                sum->buckets[i] += atomic_load_explicit(&h->buckets[i], memory_order_relaxed);
+}
+
+
+static void _getStatistics(T P, PoolStatistics_T *S) {
+        *S = (PoolStatistics_T){};
+        for (int i = 0; i < P->shardCount; i++) {
+                counters_t c = &P->shards[i].counters;
+                S->checkouts += atomic_load_explicit(&c->checkouts, memory_order_relaxed);
+                S->returns += atomic_load_explicit(&c->returns, memory_order_relaxed);
+                S->creations += atomic_load_explicit(&c->creations, memory_order_relaxed);
+                S->creationFailures += atomic_load_explicit(&c->creationFailures, memory_order_relaxed);
+                S->pingFailures += atomic_load_explicit(&c->pingFailures, memory_order_relaxed);
+                S->reaped += atomic_load_explicit(&c->reaped, memory_order_relaxed);
+                _sumHistogram(&S->checkoutWait, &c->checkoutWait);
+                _sumHistogram(&S->holdTime, &c->holdTime);
+                _sumHistogram(&S->connectTime, &c->connectTime);
+        }
+        S->peakActive = P->maxActive;
+}
+
+
+/*
+ * Push an idle Connection on the shard's return stack without taking a lock. The stack
+ * is linked through the Connections and only ever emptied as a whole with an atomic
+ * exchange by _collectIdle(), so the push is free from ABA problems
+ */
+static void _pushIdle(T P, int shard, Connection_T con) {
+        shard_t s = &P->shards[shard];
+        // Count first so a caller who sees an empty pool never misses a Connection already pushed
+        P->idleCount++;
+        Connection_T head = atomic_load(&s->returned);
+        do {
+                Connection_setNext(con, head);
+        } while (! atomic_compare_exchange_weak(&s->returned, &head, con));
+}
+
+
+/* Move returned Connections to the idle stack with the most recently returned on top. Called with s->mutex locked */
+static void _collectIdle(shard_t s) {
+        Connection_T con = atomic_exchange(&s->returned, NULL), oldest = NULL;
+        while (con) {
+                Connection_T next = Connection_getNext(con);
+                Connection_setNext(con, oldest);
+                oldest = con;
+                con = next;
+        }
+        for (con = oldest; con; con = Connection_getNext(con))
+                Vector_push(s->idle, con);
+}
+
+
+/* Pop the most recently used idle Connection from the caller's shard or steal one from a neighbour shard */
+static Connection_T _popIdle(T P) {
+        Connection_T con = NULL;
+        if (P->idleCount == 0)
+                return NULL;
+        int home = _getShard(P);
+        for (int i = 0; ! con && i < P->shardCount; i++) {
+                shard_t s = &P->shards[(home + i) % P->shardCount];
+                LOCK(s->mutex)
+                {
+                        _collectIdle(s);
+                        if (! Vector_isEmpty(s->idle)) {
+                                con = Vector_pop(s->idle);
+                                P->idleCount--;
+                        }
+                }
+                END_LOCK;
+        }
+        return con;
+}
+
+
 static void _drainPool(T P) {
+        for (parked_t slot = P->parked; slot; slot = slot->next)
+                slot->connection = NULL;
+        P->parkedCount = 0;
+        for (int i = 0; i < P->shardCount; i++) {
+                LOCK(P->shards[i].mutex)
+                {
+                        _collectIdle(&P->shards[i]);
+                        while (! Vector_isEmpty(P->shards[i].idle))
+                                Vector_pop(P->shards[i].idle);
+                }
+                END_LOCK;
+        }
+        P->idleCount = 0;
         while (! Vector_isEmpty(P->pool)) {
 		Connection_T con = Vector_pop(P->pool);
 		Connection_free(&con);
@@ -86,60 +370,1071 @@ static void _drainPool(T P) {
 }
 
 
+static void _addConnection(T P, Connection_T con) {
+        Connection_setIndex(con, Vector_size(P->pool));
+        Vector_push(P->pool, con);
+}
+
+
+/* Remove the Connection from the pool in O(1) by moving the last Connection into its slot */
+static void _removeConnection(T P, Connection_T con) {
+        int i = Connection_getIndex(con);
+        Connection_T last = Vector_pop(P->pool);
+        if (last != con) {
+                Vector_set(P->pool, i, last);
+                Connection_setIndex(last, i);
+        }
+}
+
+
+/*
+ * FIFO within a priority class. High priority waiters are queued ahead of normal priority
+ * waiters. If first is true the waiter is queued at the head of its priority class
+ */
+static void _enqueueWaiter(T P, waiter_t w, bool first) {
+        waiter_t prev = NULL;
+        w->next = NULL;
+        if (w->priority == Priority_high) {
+                if (! first)
+                        for (waiter_t q = P->waiters; q && q->priority == Priority_high; q = q->next)
+                                prev = q;
+        } else if (first) {
+                for (waiter_t q = P->waiters; q && q->priority == Priority_high; q = q->next)
+                        prev = q;
+        } else {
+                prev = P->lastWaiter;
+        }
+        if (prev) {
+                w->next = prev->next;
+                prev->next = w;
+        } else {
+                w->next = P->waiters;
+                P->waiters = w;
+        }
+        if (! w->next)
+                P->lastWaiter = w;
+        P->waiting++;
+}
+
+
+static void _dequeueWaiter(T P, waiter_t w) {
+        waiter_t prev = NULL;
+        for (waiter_t q = P->waiters; q; prev = q, q = q->next) {
+                if (q == w) {
+                        if (prev)
+                                prev->next = w->next;
+                        else
+                                P->waiters = w->next;
+                        if (P->lastWaiter == w)
+                                P->lastWaiter = prev;
+                        P->waiting--;
+                        break;
+                }
+        }
+}
+
+
+/*
+ * A tenant may not hold more than its max active Connections. Connections up to the
+ * tenant's guaranteed minimum are always available to it, the rest, and Connections
+ * for callers without a tenant, come from the capacity not guaranteed to tenants
+ */
+static bool _acquireTenantQuota(T P, int tenant) {
+        tenant_t t = tenant > 0 ? Vector_get(P->tenants, tenant - 1) : NULL;
+        if (t) {
+                int active = t->active++;
+                if (active >= t->maxActive) {
+                        t->active--;
+                        return false;
+                }
+                if (active < t->minimum)
+                        return true;
+        }
+        if (P->guaranteed > 0 && P->sharedActive++ >= P->maxConnections - P->guaranteed) {
+                P->sharedActive--;
+                if (t)
+                        t->active--;
+                return false;
+        }
+        return true;
+}
+
+
+static void _releaseTenantQuota(T P, int tenant) {
+        tenant_t t = tenant > 0 ? Vector_get(P->tenants, tenant - 1) : NULL;
+        if (t && --t->active < t->minimum)
+                return;
+        if (P->guaranteed > 0)
+                P->sharedActive--;
+}
+
+
+/*
+ * Normal priority callers may not use the Connections reserved for high priority
+ * callers and tenants are held to their quota. Returns true if the caller can have
+ * one more Connection
+ */
+static inline bool _acquireQuota(T P, Priority_T priority, int tenant) {
+        bool normal = (priority != Priority_high && P->reserved > 0);
+        if (normal && P->normalActive++ >= P->maxConnections - P->reserved) {
+                P->normalActive--;
+                return false;
+        }
+        if ((tenant > 0 || P->guaranteed > 0) && ! _acquireTenantQuota(P, tenant)) {
+                if (normal)
+                        P->normalActive--;
+                return false;
+        }
+        return true;
+}
+
+
+static inline void _releaseQuota(T P, Priority_T priority, int tenant) {
+        if (priority != Priority_high && P->reserved > 0)
+                P->normalActive--;
+        if (tenant > 0 || P->guaranteed > 0)
+                _releaseTenantQuota(P, tenant);
+}
+
+
+/*
+ * Wake the longest waiting caller in the highest priority class and hand over the 
+ * Connection. Callers without quota are skipped unless the pool is stopped. A NULL
+ * Connection signals free capacity
+ */
+static bool _signalWaiter(T P, Connection_T con) {
+        waiter_t w = P->waiters;
+        while (w && ! w->quota && ! P->stopped) {
+                if ((w->quota = _acquireQuota(P, w->priority, w->tenant)))
+                        break;
+                w = w->next;
+        }
+        if (w) {
+                _dequeueWaiter(P, w);
+                w->connection = con;
+                w->signaled = true;
+                Sem_signal(w->cond);
+                return true;
+        }
+        return false;
+}
+
+
+/* Returns true if the circuit breaker lets a connect attempt through. Called with P->mutex locked */
+static bool _allowConnect(T P) {
+        if (P->breakerThreshold == 0)
+                return true;
+        switch (P->breaker) {
+                case CircuitBreaker_open:
+                        if (Time_milli() < P->breakerTime + P->breakerBackoff)
+                                return false;
+                        DEBUG("Circuit breaker half-open, probing database\n");
+                        P->breaker = CircuitBreaker_halfOpen;
+                        P->probing = false;
+                        // Fall through
+                case CircuitBreaker_halfOpen:
+                        // Only a single probe is let through
+                        if (P->probing)
+                                return false;
+                        P->probing = true;
+                        return true;
+                default:
+                        return true;
+        }
+}
+
+
+/* Update the circuit breaker with the outcome of a connect attempt. Called with P->mutex locked */
+static void _updateBreaker(T P, bool connected) {
+        if (P->breakerThreshold == 0)
+                return;
+        if (connected) {
+                bool probed = (P->breaker != CircuitBreaker_closed);
+                P->breaker = CircuitBreaker_closed;
+                P->failures = 0;
+                P->probing = false;
+                if (probed) {
+                        DEBUG("Circuit breaker closed\n");
+                        // Wake callers who waited for the probe. The probe's Connection is not in the pool yet
+                        for (int n = P->maxConnections - Vector_size(P->pool) - P->pending - 1; n > 0 && _signalWaiter(P, NULL); n--)
+                                ;
+                }
+        } else if (++P->failures >= P->breakerThreshold || P->breaker == CircuitBreaker_halfOpen) {
+                if (P->breaker != CircuitBreaker_open)
+                        DEBUG("Circuit breaker open after %d failed connection attempts\n", P->failures);
+                P->breaker = CircuitBreaker_open;
+                P->breakerTime = Time_milli();
+                P->probing = false;
+                // Fail waiting callers fast instead of letting them wait for the timeout
+                while (_signalWaiter(P, NULL))
+                        ;
+        }
+}
+
+
+/* Prepare the registered statements on a new Connection. Called without P->mutex locked */
+static void _registerStatements(T P, Connection_T con) {
+        for (int i = 0; i < Vector_size(P->statements); i++)
+                Connection_registerStatement(con, Vector_get(P->statements, i));
+}
+
+
+/*
+ * Connect to the database without holding P->mutex so a slow connect does not block
+ * other callers. The slot is reserved in P->pending and counts against maxConnections
+ * while the connection is in progress. Registered statements are prepared here too, 
+ * so they are never parsed on the request path. Called with P->mutex locked
+ */
+static Connection_T _newConnection(T P, char **error) {
+        if (! _allowConnect(P)) {
+                *error = Str_dup("circuit breaker is open");
+                return NULL;
+        }
+        P->pending++;
+        Mutex_unlock(P->mutex);
+        long long start = Time_micro();
+        Connection_T con = Connection_new(P, error);
+        long long elapsed = Time_micro() - start;
+        if (con)
+                _registerStatements(P, con);
+        Mutex_lock(P->mutex);
+        P->pending--;
+        _updateBreaker(P, con != NULL);
+        if (con) {
+                COUNT(P, creations, 1);
+                RECORD(P, connectTime, elapsed);
+        } else {
+                COUNT(P, creationFailures, 1);
+        }
+        // Moving average of connect latency in milliseconds used by the adaptive sizing controller
+        elapsed /= USEC_PER_MSEC;
+        P->connectTime = P->connectTime ? (7 * P->connectTime + elapsed) / 8 : elapsed;
+        if (con && P->maxLifetime > 0) {
+                // Retire between 80% and 100% of max lifetime so Connections opened together are not recycled together
+                long long lifetime = (long long)P->maxLifetime * MSEC_PER_SEC;
+                Connection_setExpiryTime(con, Time_milli() + lifetime - random() % (lifetime / 5 + 1));
+        }
+        return con;
+}
+
+
+static inline bool _isExpired(Connection_T con) {
+        long long expiryTime = Connection_getExpiryTime(con);
+        return expiryTime > 0 && Time_milli() >= expiryTime;
+}
+
+
+static void *_doFill(void *args) {
+        fill_t F = args;
+        T P = F->P;
+        LOCK(P->mutex)
+        {
+                while (F->next < P->initialConnections) {
+                        char *error = NULL;
+                        int i = F->next++;
+                        long long start = Time_milli();
+                        Connection_T con = _newConnection(P, &error);
+                        long long elapsed = Time_milli() - start;
+                        if (! con) {
+                                // Stop filling on first error, as connecting is likely to fail for other threads as well
+                                F->next = P->initialConnections;
+                                if (F->error)
+                                        FREE(error);
+                                else
+                                        F->error = error;
+                                break;
+                        }
+                        DEBUG("Initial connection %d established in %lld ms\n", i, elapsed);
+                        F->connectTime += elapsed;
+                        F->maxConnectTime = MAX(F->maxConnectTime, elapsed);
+                        F->created++;
+                        _addConnection(P, con);
+                        _pushIdle(P, i % P->shardCount, con);
+                }
+        }
+        END_LOCK;
+        return NULL;
+}
+
+
+/*
+ * Open initial connections concurrently on a bounded set of threads. The pool is 
+ * filled if at least one connection was established. Called with P->mutex locked
+ */
 static bool _fillPool(T P) {
-	for (int i = 0; i < P->initialConnections; i++) {
-                Connection_T con = Connection_new(P, &P->error);
-		if (! con) {
-                        if (i > 0) {
-                                DEBUG("Failed to fill the pool with initial connections -- %s\n", P->error);
-                                FREE(P->error);
-                                return true;
+        Thread_T threads[SQL_DEFAULT_FILL_THREADS];
+        struct fill_t F = {.P = P};
+        int n = MIN(P->initialConnections, SQL_DEFAULT_FILL_THREADS);
+        if (n == 0)
+                return true;
+        long long start = Time_milli();
+        Mutex_unlock(P->mutex);
+        if (n == 1) {
+                _doFill(&F);
+        } else {
+                for (int i = 0; i < n; i++)
+                        Thread_create(threads[i], _doFill, &F);
+                for (int i = 0; i < n; i++)
+                        Thread_join(threads[i]);
+        }
+        Mutex_lock(P->mutex);
+        if (F.created == 0) {
+                P->error = F.error;
+                return false;
+        }
+        if (F.error) {
+                DEBUG("Failed to fill the pool with initial connections -- %s\n", F.error);
+                FREE(F.error);
+        }
+        DEBUG("Filled pool with %d connections in %lld ms using %d threads, average connect time %lld ms, max %lld ms\n",
+              F.created, Time_milli() - start, n, F.connectTime / F.created, F.maxConnectTime);
+        return true;
+}
+
+
+/*
+ * Returns true if the Connection can be handed out according to the validation policy.
+ * On checkout, a socket liveness test is used and a ping only if the socket looks suspicious
+ */
+static inline bool _isValid(T P, Connection_T con) {
+        if (P->validation != Validation_onCheckout)
+                return true;
+        if (P->validationWindow > 0 && (Time_milli() - Connection_getLastAccessedMilli(con)) < P->validationWindow)
+                return true;
+        return Connection_isAlive(con);
+}
+
+
+static inline int _getActive(T P) {
+        return Vector_size(P->pool) - P->idleCount - P->parkedCount - P->reaping;
+}
+
+
+/*
+ * Move parked Connections not used since the given time to the idle stacks so
+ * other threads can use them. If since is 0, all parked Connections are moved.
+ * Called with P->mutex locked
+ */
+static int _reclaimParked(T P, long long since) {
+        int n = 0;
+        for (parked_t slot = P->parked; slot && P->parkedCount > 0; slot = slot->next) {
+                Connection_T con = slot->connection;
+                if (con && (since == 0 || Connection_getLastAccessedMilli(con) < since)) {
+                        if (atomic_compare_exchange_strong(&slot->connection, &con, NULL)) {
+                                P->parkedCount--;
+                                _pushIdle(P, 0, con);
+                                n++;
                         }
-                        return false;
                 }
-		Vector_push(P->pool, con);
-	}
-	return true;
+        }
+        return n;
+}
+
+
+/*
+ * Take the next reap candidate at or above position *i and below limit of the shard's
+ * idle stack.
+ * The idle stacks are LIFO, so the bottom of a stack holds the least recently 
+ * used Connections and these are visited first. A Connection to be closed is 
+ * also removed from the pool; a Connection to be pinged stays in the pool and is
+ * counted in P->reaping while it is off the idle stack. Called with P->mutex locked
+ */
+static Connection_T _takeCandidate(T P, shard_t s, int *i, int limit, int x, time_t timedout, bool *close) {
+        Connection_T con = NULL;
+        LOCK(s->mutex)
+        {
+                _collectIdle(s);
+                while (! con && *i < MIN(limit, Vector_size(s->idle))) {
+                        Connection_T c = Vector_get(s->idle, *i);
+                        if (x > 0 && Connection_getLastAccessedTime(c) < timedout) {
+                                *close = true;
+                        } else if (x <= 0 && P->validation != Validation_background) {
+                                (*i)++;
+                                continue;
+                        }
+                        con = Vector_remove(s->idle, *i);
+                        P->idleCount--;
+                }
+        }
+        END_LOCK;
+        if (con) {
+                if (*close)
+                        _removeConnection(P, con);
+                else
+                        P->reaping++;
+        }
+        return con;
+}
+
+
+/*
+ * Candidates are taken off the idle stacks one at a time, so a sweep only ever 
+ * holds a single idle Connection and the rest stay available for checkout. Pings
+ * and closes are done without the pool lock. A Connection which survives the
+ * ping is put back at its old position in its shard so LRU order is kept. With
+ * background validation, every idle Connection is pinged and removed if dead.
+ * If reap is false, idle Connections are only validated. Must be called without
+ * P->mutex locked
+ */
+static int _reapConnections(T P, bool reap) {
+        int n = 0, x = 0;
+        time_t timedout = 0;
+        LOCK(P->mutex)
+        {
+                if (reap) {
+                        x = Vector_size(P->pool) - _getActive(P) - MAX(P->initialConnections, P->minIdle);
+                        if (P->adaptive)
+                                x = MIN(x, Vector_size(P->pool) - P->target);
+                        timedout = Time_now() - P->connectionTimeout;
+                }
+        }
+        END_LOCK;
+        for (int k = 0; k < P->shardCount && ! P->stopped; k++) {
+                shard_t s = &P->shards[k];
+                int i = 0, limit = 0;
+                // Connections returned during the sweep are pushed above limit and not visited
+                LOCK(s->mutex)
+                {
+                        _collectIdle(s);
+                        limit = Vector_size(s->idle);
+                }
+                END_LOCK;
+                while (! P->stopped) {
+                        bool close = false;
+                        Connection_T con = NULL;
+                        LOCK(P->mutex)
+                        {
+                                con = _takeCandidate(P, s, &i, limit, x, timedout, &close);
+                                if (close) {
+                                        x--;
+                                        _signalWaiter(P, NULL);
+                                }
+                        }
+                        END_LOCK;
+                        if (! con)
+                                break;
+                        if (! close && ! Connection_ping(con)) {
+                                COUNT(P, pingFailures, 1);
+                                close = true;
+                                LOCK(P->mutex)
+                                {
+                                        P->reaping--;
+                                        _removeConnection(P, con);
+                                        _signalWaiter(P, NULL);
+                                }
+                                END_LOCK;
+                        } else if (! close) {
+                                LOCK(P->mutex)
+                                {
+                                        P->reaping--;
+                                        if (_signalWaiter(P, con)) {
+                                                Connection_setAvailable(con, false);
+                                                limit--;
+                                        } else {
+                                                LOCK(s->mutex)
+                                                {
+                                                        Vector_insert(s->idle, MIN(i, Vector_size(s->idle)), con);
+                                                        P->idleCount++;
+                                                }
+                                                END_LOCK;
+                                                i++;
+                                        }
+                                }
+                                END_LOCK;
+                        }
+                        if (close) {
+                                limit--;
+                                COUNT(P, reaped, 1);
+                                Connection_free(&con);
+                                n++;
+                        }
+                }
+        }
+        return n;
+}
+
+
+/* Remove a Connection which failed validation from the pool and close it outside the pool lock */
+static void _closeConnection(T P, Connection_T con) {
+        DEBUG("Closing connection which failed validation\n");
+        COUNT(P, pingFailures, 1);
+        LOCK(P->mutex)
+        {
+                _removeConnection(P, con);
+                _signalWaiter(P, NULL);
+        }
+        END_LOCK;
+        Connection_free(&con);
+}
+
+
+/* Hand out a validated idle Connection. Does not require the pool lock */
+static Connection_T _getIdleConnection(T P) {
+        Connection_T con;
+        while ((con = _popIdle(P))) {
+                if (_isValid(P, con)) {
+                        Connection_setAvailable(con, false);
+                        if (P->idleCount < P->minIdle) {
+                                LOCK(P->mutex)
+                                {
+                                        Sem_signal(P->alarm);
+                                }
+                                END_LOCK;
+                        }
+                        return con;
+                }
+                _closeConnection(P, con);
+        }
+        return NULL;
+}
+
+
+/* Park a returned Connection in the calling thread's slot */
+static void _parkConnection(T P, Connection_T con) {
+        parked_t slot = ThreadData_get(P->parkedKey);
+        if (! slot) {
+                NEW(slot);
+                slot->P = P;
+                LOCK(P->mutex)
+                {
+                        slot->next = P->parked;
+                        P->parked = slot;
+                }
+                END_LOCK;
+                ThreadData_set(P->parkedKey, slot);
+        }
+        Connection_setAvailable(con, true);
+        P->parkedCount++;
+        Connection_T previous = atomic_exchange(&slot->connection, con);
+        if (previous) {
+                // The thread held more than one Connection
+                P->parkedCount--;
+                _pushIdle(P, _getShard(P), previous);
+        }
+}
+
+
+/* Take back the Connection parked by the calling thread, unless another thread reclaimed it */
+static Connection_T _getParkedConnection(T P) {
+        if (! P->affinity)
+                return NULL;
+        parked_t slot = ThreadData_get(P->parkedKey);
+        if (slot) {
+                Connection_T con = atomic_exchange(&slot->connection, NULL);
+                if (con) {
+                        P->parkedCount--;
+                        if (_isValid(P, con)) {
+                                Connection_setAvailable(con, false);
+                                return con;
+                        }
+                        _closeConnection(P, con);
+                }
+        }
+        return NULL;
+}
+
+
+/*
+ * ThreadData destructor. Give the parked Connection back to the pool when the thread
+ * exits. The slot is owned by the thread; if the pool was freed, the slot was detached
+ * and only the slot is freed
+ */
+static void _unparkThread(void *args) {
+        parked_t slot = args;
+        LOCK(kParkedMutex)
+        {
+                T P = slot->P;
+                if (P) {
+                        LOCK(P->mutex)
+                        {
+                                Connection_T con = atomic_exchange(&slot->connection, NULL);
+                                if (con) {
+                                        P->parkedCount--;
+                                        _pushIdle(P, 0, con);
+                                        _wakeWaiters(P);
+                                }
+                                for (parked_t *p = &P->parked; *p; p = &(*p)->next) {
+                                        if (*p == slot) {
+                                                *p = slot->next;
+                                                break;
+                                        }
+                                }
+                        }
+                        END_LOCK;
+                }
+        }
+        END_LOCK;
+        FREE(slot);
+}
+
+
+/*
+ * Delete the ThreadData key and detach the slots from the pool. An exiting thread may
+ * already be in _unparkThread() with its slot, so only the calling thread's own slot is
+ * freed here. The slot of a thread which is still running is not freed, as its 
+ * destructor is no longer called once the key is deleted
+ */
+static void _freeParked(T P) {
+        parked_t own = ThreadData_get(P->parkedKey);
+        LOCK(kParkedMutex)
+        {
+                ThreadData_delete(P->parkedKey);
+                while (P->parked) {
+                        parked_t slot = P->parked;
+                        P->parked = slot->next;
+                        slot->P = NULL;
+                }
+        }
+        END_LOCK;
+        FREE(own);
+}
+
+
+/* Hand idle Connections to waiting callers. Called with P->mutex locked */
+static void _wakeWaiters(T P) {
+        Connection_T con;
+        while (P->waiters && (con = _popIdle(P))) {
+                Connection_setAvailable(con, false);
+                if (! _signalWaiter(P, con)) {
+                        // Only callers without quota are waiting
+                        Connection_setAvailable(con, true);
+                        _pushIdle(P, _getShard(P), con);
+                        break;
+                }
+        }
+}
+
+
+/* Create a new Connection if the pool has capacity. Called with P->mutex locked */
+static Connection_T _getConnection(T P) {
+        Connection_T con;
+        if (P->stopped)
+                return NULL;
+        if (Vector_size(P->pool) + P->pending < P->maxConnections) {
+                char *error = NULL;
+                con = _newConnection(P, &error);
+                if (con) {
+                        if (P->stopped) {
+                                Connection_free(&con);
+                                return NULL;
+                        }
+                        Connection_setAvailable(con, false);
+                        _addConnection(P, con);
+                        return con;
+                }
+                DEBUG("Failed to create connection -- %s\n", error);
+                FREE(error);
+                // Give the reserved slot to a waiting caller. Not if the circuit breaker is half-open and
+                // refused the attempt, or opened and has already failed the waiting callers
+                if (P->breaker == CircuitBreaker_closed)
+                        _signalWaiter(P, NULL);
+        }
+        return NULL;
+}
+
+
+/*
+ * Park the caller until a Connection is returned or capacity is freed. Callers are
+ * served in FIFO order; ConnectionPool_returnConnection() hands the Connection
+ * directly to the longest waiting caller. A caller woken for free capacity which
+ * could not get a Connection is queued again at the head to keep its place. While
+ * the circuit breaker is half-open, callers sleep until the probe closes the breaker
+ * or fails. Called with P->mutex locked
+ */
+static Connection_T _waitConnection(T P, Priority_T priority, int tenant, bool quota, int ms) {
+        struct waiter_t w = {.priority = priority, .tenant = tenant, .quota = quota};
+        Sem_init(w.cond);
+        w.since = Time_milli();
+        long long deadline = w.since + ms;
+        for (bool first = false; ! P->stopped; first = true) {
+                w.signaled = false;
+                _enqueueWaiter(P, &w, first);
+                // A Connection may have been returned to an idle stack or parked without the pool lock
+                _reclaimParked(P, 0);
+                _wakeWaiters(P);
+                while (! w.signaled && ! P->stopped && Time_milli() < deadline) {
+                        struct timespec wait = {.tv_sec = deadline / MSEC_PER_SEC, .tv_nsec = (deadline % MSEC_PER_SEC) * 1000000};
+                        Sem_timeWait(w.cond, P->mutex, wait);
+                }
+                if (! w.signaled) {
+                        _dequeueWaiter(P, &w);
+                        break;
+                }
+                if (w.connection || (w.connection = _getConnection(P)) || P->breaker == CircuitBreaker_open)
+                        break;
+        }
+        P->waits++;
+        if (! w.connection && w.quota)
+                _releaseQuota(P, priority, tenant);
+        Sem_destroy(w.cond);
+        return w.connection;
+}
+
+
+/* Open a new Connection in the background and hand it to a waiting caller or make it idle. Called with P->mutex locked */
+static bool _openConnection(T P) {
+        char *error = NULL;
+        Connection_T con = _newConnection(P, &error);
+        if (! con) {
+                DEBUG("Failed to create idle connection -- %s\n", error);
+                FREE(error);
+                return false;
+        }
+        if (P->stopped) {
+                Connection_free(&con);
+                return false;
+        }
+        _addConnection(P, con);
+        if (_signalWaiter(P, con))
+                Connection_setAvailable(con, false);
+        else
+                _pushIdle(P, Vector_size(P->pool) % P->shardCount, con);
+        return true;
+}
+
+
+/* Open new Connections in the background until there are at least minIdle idle Connections */
+static void _ensureMinIdle(T P) {
+        while (! P->stopped && (P->idleCount < P->minIdle) && (Vector_size(P->pool) + P->pending < P->maxConnections)) {
+                if (! _openConnection(P))
+                        break;
+        }
+}
+
+
+/* Close up to n of the least recently used idle Connections outside the pool lock. Called with P->mutex locked */
+static int _shrinkPool(T P, int n) {
+        Vector_T closed = Vector_new(n);
+        for (bool found = true; found && Vector_size(closed) < n;) {
+                found = false;
+                for (int k = 0; k < P->shardCount && Vector_size(closed) < n; k++) {
+                        shard_t s = &P->shards[k];
+                        LOCK(s->mutex)
+                        {
+                                _collectIdle(s);
+                                if (! Vector_isEmpty(s->idle)) {
+                                        // The bottom of the idle stack holds the least recently used Connection
+                                        Connection_T con = Vector_remove(s->idle, 0);
+                                        P->idleCount--;
+                                        _removeConnection(P, con);
+                                        Vector_push(closed, con);
+                                        found = true;
+                                }
+                        }
+                        END_LOCK;
+                }
+        }
+        n = Vector_size(closed);
+        COUNT(P, reaped, n);
+        Mutex_unlock(P->mutex);
+        while (! Vector_isEmpty(closed)) {
+                Connection_T con = Vector_pop(closed);
+                Connection_free(&con);
+        }
+        Vector_free(&closed);
+        Mutex_lock(P->mutex);
+        return n;
+}
+
+
+/*
+ * Adaptive sizing controller run by the reaper thread. By Little's law, the 
+ * number of Connections in use is the checkout rate times the time a Connection
+ * is held. The time it takes to open a new Connection is added so Connections
+ * are ready before callers have to wait for one. The target is never below the
+ * peak number of active Connections seen and is raised by the number of callers
+ * which had to wait. The pool grows to the target at once, while shrinking 
+ * closes a quarter of the excess idle Connections per interval so a short lull 
+ * does not empty the pool. The target includes minIdle idle Connections above
+ * the peak and shrinking never goes below minIdle idle Connections, so the 
+ * controller does not close Connections _ensureMinIdle() has to open again.
+ * Called with P->mutex locked
+ */
+static void _adaptPoolSize(T P) {
+        long long now = Time_milli();
+        long long elapsed = now - P->adaptTime;
+        if (elapsed < SQL_DEFAULT_ADAPT_INTERVAL * MSEC_PER_SEC)
+                return;
+        P->adaptTime = now;
+        PoolStatistics_T S;
+        _getStatistics(P, &S);
+        long long checkouts = S.checkouts - P->lastCheckouts;
+        long long returns = S.returns - P->lastReturns;
+        long long hold = returns ? (S.holdTime.sum - P->lastHoldTime) / returns / USEC_PER_MSEC : 0;
+        P->lastCheckouts = S.checkouts;
+        P->lastReturns = S.returns;
+        P->lastHoldTime = S.holdTime.sum;
+        int peak = atomic_exchange(&P->peakActive, _getActive(P));
+        int target = (int)((checkouts * (hold + P->connectTime) + elapsed - 1) / elapsed);
+        target = MAX(target, peak) + P->waits;
+        // Room for the minIdle idle Connections kept by _ensureMinIdle() on top of the peak
+        target = MAX(target, peak + P->minIdle);
+        target = MIN(MAX(target, P->initialConnections), P->maxConnections);
+        DEBUG("Adaptive sizing: %lld checkouts in %lld ms, held %lld ms, connect %lld ms, peak %d, waits %d, target %d\n",
+              checkouts, elapsed, hold, P->connectTime, peak, P->waits, target);
+        P->waits = 0;
+        P->target = target;
+        int size = Vector_size(P->pool) + P->pending;
+        while (! P->stopped && size++ < target) {
+                if (! _openConnection(P))
+                        break;
+        }
+        int excess = Vector_size(P->pool) - target;
+        int closable = P->idleCount - P->minIdle;
+        if (excess > 0 && closable > 0)
+                _shrinkPool(P, MIN((excess + 3) / 4, closable));
+}
+
+
+/* Take an expired idle Connection off its idle stack and out of the pool. If take is false, only test. Called with P->mutex locked */
+static Connection_T _expiredConnection(T P, bool take) {
+        Connection_T expired = NULL;
+        for (int k = 0; ! expired && k < P->shardCount; k++) {
+                shard_t s = &P->shards[k];
+                LOCK(s->mutex)
+                {
+                        _collectIdle(s);
+                        for (int i = 0; i < Vector_size(s->idle); i++) {
+                                Connection_T con = Vector_get(s->idle, i);
+                                if (_isExpired(con)) {
+                                        expired = con;
+                                        if (take) {
+                                                Vector_remove(s->idle, i);
+                                                P->idleCount--;
+                                                _removeConnection(P, con);
+                                        }
+                                        break;
+                                }
+                        }
+                }
+                END_LOCK;
+        }
+        return expired;
+}
+
+
+/*
+ * Replace Connections which have reached their maximum lifetime. A replacement
+ * is opened before an expired idle Connection is closed so idle capacity does 
+ * not drop. Connections retired in ConnectionPool_returnConnection() are counted
+ * in P->replace and replaced here. Called with P->mutex locked
+ */
+static void _recycleConnections(T P) {
+        while (! P->stopped && (P->replace > 0 || _expiredConnection(P, false))) {
+                Connection_T expired = NULL;
+                if (Vector_size(P->pool) + P->pending >= P->maxConnections) {
+                        // No room for a replacement, retire first and replace in the next round
+                        if (! (expired = _expiredConnection(P, true))) {
+                                P->replace = 0;
+                                break;
+                        }
+                        P->replace = 1;
+                } else {
+                        char *error = NULL;
+                        Connection_T con = _newConnection(P, &error);
+                        if (! con) {
+                                DEBUG("Failed to create replacement connection -- %s\n", error);
+                                FREE(error);
+                                break;
+                        }
+                        if (P->stopped) {
+                                Connection_free(&con);
+                                break;
+                        }
+                        _addConnection(P, con);
+                        if (_signalWaiter(P, con))
+                                Connection_setAvailable(con, false);
+                        else
+                                _pushIdle(P, 0, con);
+                        if (P->replace > 0)
+                                P->replace--;
+                        else
+                                expired = _expiredConnection(P, true);
+                }
+                if (expired) {
+                        DEBUG("Closing connection which reached max lifetime\n");
+                        COUNT(P, reaped, 1);
+                        Mutex_unlock(P->mutex);
+                        Connection_free(&expired);
+                        Mutex_lock(P->mutex);
+                }
+        }
+}
+
+
+/* A replica uses the settings of its primary pool. Called before the replica is started */
+static void _configureReplica(T P, T R) {
+        R->initialConnections = P->initialConnections;
+        R->maxConnections = P->maxConnections;
+        R->connectionTimeout = P->connectionTimeout;
+        R->doSweep = P->doSweep;
+        R->sweepInterval = P->sweepInterval;
+        R->validation = P->validation;
+        R->validationWindow = P->validationWindow;
+        R->minIdle = P->minIdle;
+        R->maxLifetime = P->maxLifetime;
+        R->breakerThreshold = P->breakerThreshold;
+        R->breakerBackoff = P->breakerBackoff;
+        R->statementCacheSize = P->statementCacheSize;
+        if (Vector_isEmpty(R->statements))
+                for (int i = 0; i < Vector_size(P->statements); i++)
+                        Vector_push(R->statements, Str_dup(Vector_get(P->statements, i)));
+        if (R->shardCount != P->shardCount) {
+                _freeShards(R);
+                _newShards(R, P->shardCount);
+        }
+}
+
+
+static void _startReplica(T R) {
+        TRY
+        {
+                ConnectionPool_start(R);
+                R->healthy = true;
+        }
+        ELSE
+        {
+                DEBUG("Failed to start replica %s -- %s\n", URL_toString(R->url), Exception_frame.message);
+                R->healthy = false;
+        }
+        END_TRY;
+}
+
+
+/*
+ * Health check run by the primary's reaper thread. Ping each replica over one of
+ * its idle Connections and keep a moving average of the round trip time used to
+ * weight replicas in ConnectionPool_getReadConnection(). A replica with all its
+ * Connections in use is not checked. A replica which fails is not used until a 
+ * later check succeeds. Called without P->mutex locked
+ */
+static void _checkReplicas(T P) {
+        for (int i = 0; i < Vector_size(P->replicas) && ! P->stopped; i++) {
+                T R = Vector_get(P->replicas, i);
+                if (! R->filled) {
+                        _startReplica(R);
+                        continue;
+                }
+                // Probe an idle Connection as the reaper does, a checkout could open a Connection and is counted in the statistics
+                Connection_T con = NULL;
+                bool empty = false;
+                LOCK(R->mutex)
+                {
+                        // Reconnect a replica which lost all its Connections
+                        if (Vector_size(R->pool) + R->pending == 0)
+                                _openConnection(R);
+                        if ((con = _popIdle(R)))
+                                R->reaping++;
+                        empty = (Vector_size(R->pool) == 0);
+                }
+                END_LOCK;
+                if (! con) {
+                        // Without a Connection the replica could not be reached, otherwise all are in use
+                        if (empty)
+                                R->healthy = false;
+                        continue;
+                }
+                long long start = Time_micro();
+                bool alive = Connection_ping(con);
+                long long elapsed = Time_micro() - start;
+                LOCK(R->mutex)
+                {
+                        R->reaping--;
+                        if (! alive) {
+                                _removeConnection(R, con);
+                                _signalWaiter(R, NULL);
+                        } else if (_signalWaiter(R, con)) {
+                                Connection_setAvailable(con, false);
+                        } else {
+                                _pushIdle(R, _getShard(R), con);
+                        }
+                }
+                END_LOCK;
+                if (alive) {
+                        R->latency = R->latency ? (7 * R->latency + elapsed) / 8 : elapsed;
+                } else {
+                        DEBUG("Replica %s failed health check\n", URL_toString(R->url));
+                        COUNT(R, pingFailures, 1);
+                        Connection_free(&con);
+                }
+                R->healthy = alive;
+        }
 }
 
 
-static int _getActive(T P){
-        int i, n = 0, size = Vector_size(P->pool);
-        for (i = 0; i < size; i++)
-                if (! Connection_isAvailable(Vector_get(P->pool, i))) 
-                        n++; 
-        return n; 
+/* Pick a healthy replica at random, weighted by the inverse of its latency */
+static T _selectReplica(T P) {
+        double total = 0;
+        int n = Vector_size(P->replicas);
+        for (int i = 0; i < n; i++) {
+                T R = Vector_get(P->replicas, i);
+                if (R->healthy)
+                        total += 1.0 / (R->latency + 100);
+        }
+        if (total == 0)
+                return NULL;
+        double x = total * random() / RAND_MAX;
+        for (int i = 0; i < n; i++) {
+                T R = Vector_get(P->replicas, i);
+                if (R->healthy && (x -= 1.0 / (R->latency + 100)) <= 0)
+                        return R;
+        }
+        return NULL;
 }
 
 
-static int _reapConnections(T P) {
-        int n = 0;
-        int x = Vector_size(P->pool) - _getActive(P) - P->initialConnections;
-        time_t timedout = Time_now() - P->connectionTimeout;
-        for (int i = 0; ((n < x) && (i < Vector_size(P->pool))); i++) {
-                Connection_T con = Vector_get(P->pool, i);
-                if (Connection_isAvailable(con)) {
-                        if ((Connection_getLastAccessedTime(con) < timedout) || (! Connection_ping(con))) {
-                                Vector_remove(P->pool, i);
-                                Connection_free(&con);
-                                n++;
-                                i--;
-                        }
-                } 
-        }
-        return n;
+/* Seconds between sweeps. Without ConnectionPool_setReaper(), a sweep only validates idle Connections */
+static inline int _getSweepInterval(T P) {
+        return P->doSweep ? P->sweepInterval : SQL_DEFAULT_SWEEP_INTERVAL;
 }
 
 
+/*
+ * The reaper thread. Close idle Connections every sweepInterval if the reaper 
+ * is enabled, validate idle Connections with background validation, and 
+ * pre-create Connections if idle capacity drops below minIdle.
+ * ConnectionPool_getConnection() signals the thread when idle capacity is low.
+ * With a max lifetime, the thread also wakes regularly to recycle Connections,
+ * with adaptive sizing to run the sizing controller and with replicas to check
+ * their health
+ */
 static void *_doSweep(void *args) {
         T P = args;
         struct timespec wait = {};
         Mutex_lock(P->mutex);
+        time_t sweep = Time_now() + _getSweepInterval(P);
         while (! P->stopped) {
-                wait.tv_sec = Time_now() + P->sweepInterval;
+                _ensureMinIdle(P);
+                _recycleConnections(P);
+                long long wake = (long long)sweep * MSEC_PER_SEC;
+                if (P->maxLifetime > 0)
+                        wake = MIN(wake, Time_milli() + MAX(1, P->maxLifetime / 20) * MSEC_PER_SEC);
+                if (P->adaptive)
+                        wake = MIN(wake, P->adaptTime + SQL_DEFAULT_ADAPT_INTERVAL * MSEC_PER_SEC);
+                if (! Vector_isEmpty(P->replicas))
+                        wake = MIN(wake, P->healthTime + SQL_DEFAULT_HEALTH_INTERVAL * MSEC_PER_SEC);
+                wait.tv_sec = wake / MSEC_PER_SEC;
+                wait.tv_nsec = (wake % MSEC_PER_SEC) * 1000000;
                 Sem_timeWait(P->alarm,  P->mutex, wait);
                 if (P->stopped) break;
-                _reapConnections(P);
+                if (Time_now() >= sweep) {
+                        if (P->doSweep || P->validation == Validation_background) {
+                                _reclaimParked(P, Time_milli() - _getSweepInterval(P) * MSEC_PER_SEC);
+                                Mutex_unlock(P->mutex);
+                                _reapConnections(P, P->doSweep);
+                                Mutex_lock(P->mutex);
+                        }
+                        sweep = Time_now() + _getSweepInterval(P);
+                }
+                if (P->adaptive)
+                        _adaptPoolSize(P);
+                // The reaper is also woken by checkouts, check replicas at most once per interval
+                if (! Vector_isEmpty(P->replicas) && Time_milli() >= P->healthTime + SQL_DEFAULT_HEALTH_INTERVAL * MSEC_PER_SEC) {
+                        P->healthTime = Time_milli();
+                        Mutex_unlock(P->mutex);
+                        _checkReplicas(P);
+                        Mutex_lock(P->mutex);
+                }
         }
         Mutex_unlock(P->mutex);
         DEBUG("Reaper thread stopped\n");
@@ -147,6 +1442,94 @@ static void *_doSweep(void *args) {
 }
 
 
+/* Get an idle Connection, create a new one or wait up to ms milliseconds for one */
+static Connection_T _checkout(T P, Priority_T priority, int tenant, int ms) {
+        Connection_T con = NULL;
+        bool quota = _acquireQuota(P, priority, tenant);
+        if (quota) {
+                if ((con = _getParkedConnection(P)) || (con = _getIdleConnection(P)))
+                        return con;
+                if (P->parkedCount > 0) {
+                        // The pool is running short, take back Connections parked by other threads
+                        LOCK(P->mutex)
+                        {
+                                _reclaimParked(P, 0);
+                        }
+                        END_LOCK;
+                        if ((con = _getIdleConnection(P)))
+                                return con;
+                }
+        }
+        LOCK(P->mutex)
+        {
+                if (quota)
+                        con = _getConnection(P);
+                // Fail fast while the circuit breaker is open
+                if (! con && ms > 0 && P->breaker != CircuitBreaker_open)
+                        con = _waitConnection(P, priority, tenant, quota, ms);
+                else if (! con && quota)
+                        _releaseQuota(P, priority, tenant);
+        }
+        END_LOCK;
+        return con;
+}
+
+
+/* Check out a Connection for the caller and record checkout statistics */
+static Connection_T _checkoutConnection(T P, Priority_T priority, int tenant, int ms) {
+        long long start = Time_micro();
+        Connection_T con = _checkout(P, priority, tenant, ms);
+        if (con) {
+                long long now = Time_micro();
+                Connection_setPriority(con, priority);
+                Connection_setTenant(con, tenant);
+                Connection_setCheckoutTime(con, now);
+                COUNT(P, checkouts, 1);
+                RECORD(P, checkoutWait, now - start);
+                int active = _getActive(P);
+                _atomicMax(&P->peakActive, active);
+                _atomicMax(&P->maxActive, active);
+        }
+        return con;
+}
+
+
+/* Append to the metrics buffer with snprintf semantics; length counts what would have been written */
+static void _emit(metrics_t m, const char *format, ...) {
+        va_list ap;
+        int available = (m->length < m->size) ? m->size - m->length : 0;
+        va_start(ap, format);
+        int n = vsnprintf(available ? m->buffer + m->length : NULL, available, format, ap);
+        va_end(ap);
+        if (n > 0)
+                m->length += n;
+}
+
+
+static void _emitMetric(metrics_t m, const char *name, const char *type, const char *help, long long value) {
+        bool counter = Str_isEqual(type, "counter");
+        _emit(m, "# TYPE %s %s\n# HELP %s %s\n%s%s{%s} %lld\n", name, type, name, help, name, counter ? "_total" : "", m->labels, value);
+}
+
+
+/*
+ * Histogram_T buckets are not cumulative and in microseconds, OpenMetrics buckets are cumulative and in seconds.
+ * The buckets and count are read without a lock, so +Inf and the count are taken from the bucket sum to stay monotonic
+ */
+static void _emitHistogram(metrics_t m, const char *name, const char *help, Histogram_T *h) {
+        long long count = 0;
+        const char *separator = *m->labels ? "," : "";
+        _emit(m, "# TYPE %s histogram\n# HELP %s %s\n", name, name, help);
+        for (int i = 0; i < SQL_HISTOGRAM_BUCKETS - 1; i++) {
+                count += h->buckets[i];
+                _emit(m, "%s_bucket{%s%sle=\"%.9g\"} %lld\n", name, m->labels, separator, (double)(1LL << (2 * i)) / USEC_PER_SEC, count);
+        }
+        count += h->buckets[SQL_HISTOGRAM_BUCKETS - 1];
+        _emit(m, "%s_bucket{%s%sle=\"+Inf\"} %lld\n", name, m->labels, separator, count);
+        _emit(m, "%s_sum{%s} %.9g\n%s_count{%s} %lld\n", name, m->labels, (double)h->sum / USEC_PER_SEC, name, m->labels, count);
+}
+
+
 /* ---------------------------------------------------------------- Public */
 
 
@@ -160,6 +1543,10 @@ T ConnectionPool_new(URL_T url) {
 	Mutex_init(P->mutex);
 	P->maxConnections = SQL_DEFAULT_MAX_CONNECTIONS;
         P->pool = Vector_new(SQL_DEFAULT_MAX_CONNECTIONS);
+        _newShards(P, 1);
+        P->replicas = Vector_new(4);
+        P->tenants = Vector_new(4);
+        P->statements = Vector_new(0);
 	P->initialConnections = SQL_DEFAULT_INIT_CONNECTIONS;
         P->connectionTimeout = SQL_DEFAULT_CONNECTION_TIMEOUT;
 	return P;
@@ -173,6 +1560,25 @@ void ConnectionPool_free(T *P) {
         if (! (*P)->stopped)
                 ConnectionPool_stop((*P));
         Vector_free(&pool);
+        while (! Vector_isEmpty((*P)->replicas)) {
+                T R = Vector_pop((*P)->replicas);
+                ConnectionPool_free(&R);
+        }
+        Vector_free(&(*P)->replicas);
+        while (! Vector_isEmpty((*P)->tenants)) {
+                tenant_t t = Vector_pop((*P)->tenants);
+                FREE(t->name);
+                FREE(t);
+        }
+        Vector_free(&(*P)->tenants);
+        while (! Vector_isEmpty((*P)->statements)) {
+                char *sql = Vector_pop((*P)->statements);
+                FREE(sql);
+        }
+        Vector_free(&(*P)->statements);
+        _freeShards(*P);
+        if ((*P)->affinity)
+                _freeParked(*P);
 	Mutex_destroy((*P)->mutex);
         Sem_destroy((*P)->alarm);
         FREE((*P)->error);
@@ -212,6 +1618,8 @@ void ConnectionPool_setMaxConnections(T P, int maxConnections) {
         LOCK(P->mutex)
         {
                 P->maxConnections = maxConnections;
+                for (int n = maxConnections - Vector_size(P->pool) - P->pending; n > 0 && _signalWaiter(P, NULL); n--)
+                        ;
         }
         END_LOCK;
 }
@@ -236,6 +1644,33 @@ int ConnectionPool_getConnectionTimeout(T P) {
 }
 
 
+void ConnectionPool_setValidation(T P, Validation_T validation) {
+        assert(P);
+        assert(validation >= Validation_onCheckout && validation <= Validation_background);
+        assert(validation != Validation_background || ! P->filled || P->sweeping);
+        P->validation = validation;
+}
+
+
+Validation_T ConnectionPool_getValidation(T P) {
+        assert(P);
+        return P->validation;
+}
+
+
+void ConnectionPool_setValidationWindow(T P, int ms) {
+        assert(P);
+        assert(ms >= 0);
+        P->validationWindow = ms;
+}
+
+
+int ConnectionPool_getValidationWindow(T P) {
+        assert(P);
+        return P->validationWindow;
+}
+
+
 void ConnectionPool_setAbortHandler(T P, void(*abortHandler)(const char *error)) {
         assert(P); 
         AbortHandler = abortHandler;
@@ -254,6 +1689,200 @@ void ConnectionPool_setReaper(T P, int sweepInterval) {
 }
 
 
+void ConnectionPool_setMinIdle(T P, int minIdle) {
+        assert(P);
+        assert(minIdle >= 0 && minIdle <= P->maxConnections);
+        LOCK(P->mutex)
+        {
+                P->minIdle = minIdle;
+                Sem_signal(P->alarm);
+        }
+        END_LOCK;
+}
+
+
+int ConnectionPool_getMinIdle(T P) {
+        assert(P);
+        return P->minIdle;
+}
+
+
+void ConnectionPool_setShards(T P, int shards) {
+        assert(P);
+        assert(shards >= 0);
+        assert(! P->filled);
+        if (shards == 0)
+                shards = System_getCPUs();
+        LOCK(P->mutex)
+        {
+                _freeShards(P);
+                _newShards(P, shards);
+        }
+        END_LOCK;
+}
+
+
+int ConnectionPool_getShards(T P) {
+        assert(P);
+        return P->shardCount;
+}
+
+
+void ConnectionPool_setMaxLifetime(T P, int maxLifetime) {
+        assert(P);
+        assert(maxLifetime >= 0);
+        assert(! P->filled);
+        P->maxLifetime = maxLifetime;
+}
+
+
+int ConnectionPool_getMaxLifetime(T P) {
+        assert(P);
+        return P->maxLifetime;
+}
+
+
+void ConnectionPool_setReserved(T P, int reserved) {
+        assert(P);
+        assert(reserved >= 0);
+        assert(reserved < P->maxConnections);
+        assert(! P->filled);
+        P->reserved = reserved;
+}
+
+
+int ConnectionPool_getReserved(T P) {
+        assert(P);
+        return P->reserved;
+}
+
+
+void ConnectionPool_setAdaptiveSizing(T P, bool adaptive) {
+        assert(P);
+        assert(! P->filled);
+        P->adaptive = adaptive;
+}
+
+
+bool ConnectionPool_getAdaptiveSizing(T P) {
+        assert(P);
+        return P->adaptive;
+}
+
+
+void ConnectionPool_setCircuitBreaker(T P, int failures, int backoff) {
+        assert(P);
+        assert(failures >= 0);
+        assert(backoff >= 0);
+        LOCK(P->mutex)
+        {
+                P->breakerThreshold = failures;
+                P->breakerBackoff = backoff;
+                P->breaker = CircuitBreaker_closed;
+                P->failures = 0;
+                P->probing = false;
+        }
+        END_LOCK;
+}
+
+
+int ConnectionPool_addTenant(T P, const char *name, int maxActive, int minimum) {
+        assert(P);
+        assert(name);
+        assert(! P->filled);
+        assert(maxActive > 0);
+        assert(minimum >= 0 && minimum <= maxActive);
+        assert(P->guaranteed + minimum <= P->maxConnections);
+        tenant_t t;
+        NEW(t);
+        t->name = Str_dup(name);
+        t->maxActive = maxActive;
+        t->minimum = minimum;
+        P->guaranteed += minimum;
+        Vector_push(P->tenants, t);
+        return Vector_size(P->tenants);
+}
+
+
+int ConnectionPool_getTenant(T P, const char *name) {
+        assert(P);
+        for (int i = 0; i < Vector_size(P->tenants); i++) {
+                tenant_t t = Vector_get(P->tenants, i);
+                if (Str_isEqual(t->name, name))
+                        return i + 1;
+        }
+        return 0;
+}
+
+
+CircuitBreaker_T ConnectionPool_getCircuitBreaker(T P) {
+        assert(P);
+        if (P->breaker == CircuitBreaker_open && Time_milli() >= P->breakerTime + P->breakerBackoff)
+                return CircuitBreaker_halfOpen;
+        return P->breaker;
+}
+
+
+int ConnectionPool_getTargetSize(T P) {
+        assert(P);
+        return P->adaptive ? P->target : P->maxConnections;
+}
+
+
+void ConnectionPool_setThreadAffinity(T P, bool affinity) {
+        assert(P);
+        assert(! P->filled);
+        if (affinity && ! P->affinity)
+                ThreadData_create(P->parkedKey, _unparkThread);
+        else if (! affinity && P->affinity)
+                _freeParked(P);
+        P->affinity = affinity;
+}
+
+
+bool ConnectionPool_getThreadAffinity(T P) {
+        assert(P);
+        return P->affinity;
+}
+
+
+void ConnectionPool_setStatementCacheSize(T P, int size) {
+        assert(P);
+        assert(size >= 0);
+        assert(! P->filled);
+        P->statementCacheSize = size;
+}
+
+
+int ConnectionPool_getStatementCacheSize(T P) {
+        assert(P);
+        return P->statementCacheSize;
+}
+
+
+int ConnectionPool_registerStatement(T P, const char *sql) {
+        assert(P);
+        assert(sql);
+        assert(! P->filled);
+        Vector_push(P->statements, Str_dup(sql));
+        return Vector_size(P->statements);
+}
+
+
+void ConnectionPool_addReplica(T P, URL_T url) {
+        assert(P);
+        assert(url);
+        assert(! P->filled);
+        Vector_push(P->replicas, ConnectionPool_new(url));
+}
+
+
+int ConnectionPool_getReplicas(T P) {
+        assert(P);
+        return Vector_size(P->replicas);
+}
+
+
 int ConnectionPool_size(T P) {
         assert(P);
         return Vector_size(P->pool);
@@ -272,6 +1901,92 @@ int ConnectionPool_active(T P) {
 }
 
 
+void ConnectionPool_getStatistics(T P, PoolStatistics_T *statistics) {
+        assert(P);
+        assert(statistics);
+        _getStatistics(P, statistics);
+        statistics->size = ConnectionPool_size(P);
+        statistics->active = MAX(0, _getActive(P));
+        statistics->waiting = P->waiting;
+        statistics->maxConnections = P->maxConnections;
+}
+
+
+int ConnectionPool_renderMetrics(T P, const char *name, char *buffer, int size) {
+        PoolStatistics_T s;
+        struct metrics_t m = {.size = size, .buffer = buffer};
+        assert(P);
+        assert(buffer || size == 0);
+        assert(size >= 0);
+        if (name && *name) {
+                // Escape the label value as required by the exposition format
+                int j = snprintf(m.labels, sizeof(m.labels), "pool=\"");
+                for (const char *c = name; *c && j < (int)sizeof(m.labels) - 4; c++) {
+                        if (*c == '"' || *c == '\\' || *c == '\n')
+                                m.labels[j++] = '\\';
+                        m.labels[j++] = (*c == '\n') ? 'n' : *c;
+                }
+                m.labels[j++] = '"';
+                m.labels[j] = 0;
+        }
+        if (size > 0)
+                *buffer = 0;
+        ConnectionPool_getStatistics(P, &s);
+        _emitMetric(&m, "zdb_pool_connections", "gauge", "Number of connections in the pool", s.size);
+        _emitMetric(&m, "zdb_pool_active_connections", "gauge", "Number of connections in use", s.active);
+        _emitMetric(&m, "zdb_pool_idle_connections", "gauge", "Number of idle connections", MAX(0, s.size - s.active));
+        _emitMetric(&m, "zdb_pool_waiting_callers", "gauge", "Number of callers waiting for a connection", s.waiting);
+        _emitMetric(&m, "zdb_pool_max_connections", "gauge", "Maximum number of connections", s.maxConnections);
+        _emitMetric(&m, "zdb_pool_peak_active_connections", "gauge", "Highest number of connections in use", s.peakActive);
+        _emitMetric(&m, "zdb_pool_checkouts", "counter", "Connections handed out", s.checkouts);
+        _emitMetric(&m, "zdb_pool_returns", "counter", "Connections returned to the pool", s.returns);
+        _emitMetric(&m, "zdb_pool_connections_created", "counter", "Connections opened", s.creations);
+        _emitMetric(&m, "zdb_pool_connection_failures", "counter", "Failed attempts to open a connection", s.creationFailures);
+        _emitMetric(&m, "zdb_pool_ping_failures", "counter", "Connections closed because they failed validation", s.pingFailures);
+        _emitMetric(&m, "zdb_pool_connections_reaped", "counter", "Connections closed by the pool", s.reaped);
+        _emitHistogram(&m, "zdb_pool_checkout_wait_seconds", "Time spent getting a connection from the pool", &s.checkoutWait);
+        _emitHistogram(&m, "zdb_pool_hold_seconds", "Time a connection was checked out", &s.holdTime);
+        _emitHistogram(&m, "zdb_pool_connect_seconds", "Time spent opening a connection", &s.connectTime);
+        _emit(&m, "# EOF\n");
+        return m.length;
+}
+
+
+int ConnectionPool_prepared(T P, int handle) {
+        int n = 0;
+        assert(P);
+        assert(handle > 0 && handle <= Vector_size(P->statements));
+        LOCK(P->mutex)
+        {
+                for (int i = 0; i < Vector_size(P->pool); i++)
+                        if (Connection_isPrepared(Vector_get(P->pool, i), handle))
+                                n++;
+        }
+        END_LOCK;
+        return n;
+}
+
+
+int ConnectionPool_waiting(T P) {
+        assert(P);
+        return P->waiting;
+}
+
+
+long long ConnectionPool_waitTime(T P) {
+        long long ms = 0;
+        assert(P);
+        LOCK(P->mutex)
+        {
+                // High priority waiters are queued first, so the oldest may be further back
+                for (waiter_t w = P->waiters; w; w = w->next)
+                        ms = MAX(ms, Time_milli() - w->since);
+        }
+        END_LOCK;
+        return ms;
+}
+
+
 /* -------------------------------------------------------- Public methods */
 
 
@@ -283,8 +1998,16 @@ void ConnectionPool_start(T P) {
                 if (! P->filled) {
                         P->filled = _fillPool(P);
                         if (P->filled) {
-                                if (P->doSweep) {
+                                P->target = Vector_size(P->pool);
+                                P->adaptTime = Time_milli();
+                                for (int i = 0; i < Vector_size(P->replicas); i++) {
+                                        T R = Vector_get(P->replicas, i);
+                                        _configureReplica(P, R);
+                                        _startReplica(R);
+                                }
+                                if (P->doSweep || P->validation == Validation_background || P->minIdle > 0 || P->maxLifetime > 0 || P->adaptive || ! Vector_isEmpty(P->replicas)) {
                                         DEBUG("Starting Database reaper thread\n");
+                                        P->sweeping = true;
                                         Thread_create(P->reaper, _doSweep, P);
                                 }
                         }
@@ -302,51 +2025,94 @@ void ConnectionPool_stop(T P) {
         LOCK(P->mutex)
         {
                 P->stopped = true;
-                if (P->filled) {
-                        _drainPool(P);
-                        P->filled = false;
-                        stopSweep = (P->doSweep && P->reaper);
-                }
+                while (_signalWaiter(P, NULL))
+                        ;
+                stopSweep = P->sweeping;
+                P->sweeping = false;
         }
         END_LOCK;
+        // Join the reaper before draining, it may hold an idle Connection it is pinging
         if (stopSweep) {
                 DEBUG("Stopping Database reaper thread...\n");
                 Sem_signal(P->alarm);
                 Thread_join(P->reaper);
         }
+        LOCK(P->mutex)
+        {
+                if (P->filled) {
+                        _drainPool(P);
+                        P->filled = false;
+                }
+        }
+        END_LOCK;
+        for (int i = 0; i < Vector_size(P->replicas); i++) {
+                T R = Vector_get(P->replicas, i);
+                if (! R->stopped)
+                        ConnectionPool_stop(R);
+        }
 }
 
 
 Connection_T ConnectionPool_getConnection(T P) {
-	Connection_T con = NULL;
+        return ConnectionPool_getConnectionWithTimeout(P, 0);
+}
+
+
+Connection_T ConnectionPool_getReadConnection(T P) {
+        Connection_T con = NULL;
+        assert(P);
+        T R = _selectReplica(P);
+        if (R)
+                con = ConnectionPool_getConnection(R);
+        // The selected replica is exhausted, try the other healthy replicas before the primary
+        for (int i = 0; ! con && R && i < Vector_size(P->replicas); i++) {
+                T r = Vector_get(P->replicas, i);
+                if (r != R && r->healthy)
+                        con = ConnectionPool_getConnection(r);
+        }
+        return con ? con : ConnectionPool_getConnection(P);
+}
+
+
+Connection_T ConnectionPool_getConnectionWithTimeout(T P, int ms) {
+        return ConnectionPool_getConnectionWithPriority(P, Priority_normal, ms);
+}
+
+
+Connection_T ConnectionPool_getConnectionWithPriority(T P, Priority_T priority, int ms) {
 	assert(P);
-	LOCK(P->mutex) 
-        {
-                int size = Vector_size(P->pool);
-                for (int i = 0; i < size; i++) {
-                        con = Vector_get(P->pool, i);
-                        if (Connection_isAvailable(con)) {
-                                if (Connection_ping(con)) {
-                                        Connection_setAvailable(con, false);
-                                        goto done;
-                                }
-                        }
-                }
-                con = NULL;
-                if (size < P->maxConnections) {
-                        con = Connection_new(P, &P->error);
-                        if (con) {
-                                Connection_setAvailable(con, false);
-                                Vector_push(P->pool, con);
-                        } else {
-                                DEBUG("Failed to create connection -- %s\n", P->error);
-                                FREE(P->error);
-                        }
-                }
+        assert(ms >= 0);
+        return _checkoutConnection(P, priority, 0, ms);
+}
+
+
+Connection_T ConnectionPool_getConnectionForTenant(T P, int tenant, int ms) {
+	assert(P);
+        assert(tenant > 0 && tenant <= Vector_size(P->tenants));
+        assert(ms >= 0);
+        tenant_t t = Vector_get(P->tenants, tenant - 1);
+        Connection_T con = _checkoutConnection(P, Priority_normal, tenant, ms);
+        if (con) {
+                t->checkouts++;
+                _atomicMax(&t->peakActive, t->active);
+        } else {
+                t->rejected++;
         }
-done: 
-        END_LOCK;
-	return con;
+        return con;
+}
+
+
+void ConnectionPool_getTenantStatistics(T P, int tenant, TenantStatistics_T *statistics) {
+        assert(P);
+        assert(tenant > 0 && tenant <= Vector_size(P->tenants));
+        assert(statistics);
+        tenant_t t = Vector_get(P->tenants, tenant - 1);
+        *statistics = (TenantStatistics_T){
+                .active = t->active,
+                .peakActive = t->peakActive,
+                .checkouts = t->checkouts,
+                .rejected = t->rejected
+        };
 }
 
 
@@ -361,23 +2127,73 @@ void ConnectionPool_returnConnection(T P, Connection_T connection) {
                 END_TRY;
 	}
 	Connection_clear(connection);
-	LOCK(P->mutex)
-        {
-		Connection_setAvailable(connection, true);
+        if (Connection_isAvailable(connection))
+                return;
+        _releaseQuota(P, Connection_getPriority(connection), Connection_getTenant(connection));
+        COUNT(P, returns, 1);
+        RECORD(P, holdTime, Time_micro() - Connection_getCheckoutTime(connection));
+        if (P->validation == Validation_onReturn && ! Connection_ping(connection)) {
+                _closeConnection(P, connection);
+                return;
+        }
+        if (_isExpired(connection)) {
+                DEBUG("Closing connection which reached max lifetime\n");
+                COUNT(P, reaped, 1);
+                LOCK(P->mutex)
+                {
+                        _removeConnection(P, connection);
+                        // A waiting caller opens its own Connection, otherwise the reaper replaces it
+                        if (! _signalWaiter(P, NULL) && ! P->stopped) {
+                                P->replace++;
+                                Sem_signal(P->alarm);
+                        }
+                }
+                END_LOCK;
+                Connection_free(&connection);
+                return;
+        }
+        if (P->affinity && P->waiting == 0) {
+                _parkConnection(P, connection);
+                // A caller may have started waiting after the check above
+                if (P->waiting > 0) {
+                        LOCK(P->mutex)
+                        {
+                                _reclaimParked(P, 0);
+                                _wakeWaiters(P);
+                        }
+                        END_LOCK;
+                }
+                return;
+        }
+        if (P->waiting > 0) {
+                bool handedOver = false;
+                LOCK(P->mutex)
+                {
+                        if (P->waiters) {
+                                Connection_setAvailable(connection, false);
+                                handedOver = _signalWaiter(P, connection);
+                        }
+                }
+                END_LOCK;
+                if (handedOver)
+                        return;
+        }
+        Connection_setAvailable(connection, true);
+        _pushIdle(P, _getShard(P), connection);
+        // A caller may have started waiting after the check above
+        if (P->waiting > 0) {
+                LOCK(P->mutex)
+                {
+                        _wakeWaiters(P);
+                }
+                END_LOCK;
         }
-	END_LOCK;
 }
 
 
 int ConnectionPool_reapConnections(T P) {
-        int n = 0;
         assert(P);
-        LOCK(P->mutex)
-        {
-                n = _reapConnections(P);
-        }
-        END_LOCK;
-        return n;
+        return _reapConnections(P, true);
 }
 
 
@@ -45,7 +45,10 @@
  * connection is created and returned. If the pool has already handed out
  * <i>maxConnections</i> Connections, the next call to 
  * ConnectionPool_getConnection() will return NULL. Use Connection_close()
- * to return a connection to the pool so it can be reused.
+ * to return a connection to the pool so it can be reused. Instead of
+ * polling the pool when it is exhausted, callers can use
+ * ConnectionPool_getConnectionWithTimeout() to wait for a connection to
+ * be returned. Waiting callers are served in the order they arrived.
  *
  * A connection pool is created default with 5 initial connections and 
  * with 20 maximum connections. These values can be changed by the property 
@@ -218,12 +221,25 @@
  * It is recommended to start the pool with a reaper-thread, especially if
  * the pool maintains TCP/IP Connections.
  *
+ * <h2 class="desc">Read replicas:</h2>
+ * Read-only work can be spread over one or more replica databases. Replicas
+ * are added with ConnectionPool_addReplica() before the pool is started and
+ * are started together with the primary pool, using the same properties.
+ * ConnectionPool_getReadConnection() returns a connection to a healthy replica,
+ * chosen at random and weighted by the observed round trip time of the 
+ * replica, so faster replicas get more of the load. The reaper thread checks
+ * the health and latency of each replica at a regular interval. Writes and 
+ * transactions should use ConnectionPool_getConnection(), which always 
+ * returns a connection to the primary database.
+ *
  * <h2 class="desc">Realtime inspection:</h2>
  * Two methods can be used to inspect the pool at runtime. The method 
  * ConnectionPool_size() returns the number of connections in the pool, that is,
  * both active and inactive connections. The method ConnectionPool_active() 
  * returns the number of active connections, i.e. those connections in 
- * current use by your application. 
+ * current use by your application. ConnectionPool_waiting() and 
+ * ConnectionPool_waitTime() report on callers waiting for a connection
+ * in ConnectionPool_getConnectionWithTimeout().
  *
  * <i>This ConnectionPool is thread-safe.</i>
  *
@@ -235,6 +251,94 @@
 #define T ConnectionPool_T
 typedef struct ConnectionPool_S *T;
 
+
+/**
+ * Connection validation policy. Specify when the pool should test, using
+ * Connection_ping(), that a Connection is alive. 
+ * @see ConnectionPool_setValidation()
+ */
+typedef enum {
+        Validation_onCheckout = 0, /**< Validate when the Connection is handed out (default) */
+        Validation_onReturn,       /**< Validate when the Connection is returned to the pool */
+        Validation_background      /**< Only the reaper thread validates idle Connections, every sweep interval */
+} Validation_T;
+
+
+/**
+ * Checkout priority class.
+ * @see ConnectionPool_getConnectionWithPriority()
+ */
+typedef enum {
+        Priority_normal = 0, /**< Normal priority, e.g. batch jobs (default) */
+        Priority_high        /**< High priority, e.g. latency critical requests */
+} Priority_T;
+
+
+/**
+ * Usage counters of a tenant.
+ * @see ConnectionPool_getTenantStatistics()
+ */
+typedef struct {
+        int active;            /**< Connections currently held by the tenant */
+        int peakActive;        /**< Maximum number of Connections held at the same time */
+        long long checkouts;   /**< Connections handed out to the tenant */
+        long long rejected;    /**< Checkouts which did not get a Connection */
+} TenantStatistics_T;
+
+
+/**
+ * Circuit breaker state.
+ * @see ConnectionPool_setCircuitBreaker()
+ */
+typedef enum {
+        CircuitBreaker_closed = 0, /**< Connections are opened as usual (default) */
+        CircuitBreaker_open,       /**< Opening connections fails immediately */
+        CircuitBreaker_halfOpen    /**< A single connection attempt probes the database */
+} CircuitBreaker_T;
+
+
+/**
+ * Number of buckets in a Histogram_T
+ */
+#define SQL_HISTOGRAM_BUCKETS 16
+
+
+/**
+ * A latency histogram. Bucket <code>i</code> counts samples greater than
+ * 4^(i-1) and up to 4^i microseconds, i.e. bucket 0 counts samples up to 1
+ * microsecond, bucket 5 up to 1.024 milliseconds and bucket 10 up to 1.05 
+ * seconds. The last bucket counts all samples above 4^14 microseconds.
+ * @see ConnectionPool_getStatistics()
+ */
+typedef struct Histogram_T {
+        long long count;                             /**< Number of samples */
+        long long sum;                               /**< Sum of samples in microseconds */
+        long long buckets[SQL_HISTOGRAM_BUCKETS];    /**< Number of samples per bucket */
+} Histogram_T;
+
+
+/**
+ * A snapshot of connection pool statistics. Counters are totals since 
+ * the pool was created.
+ * @see ConnectionPool_getStatistics()
+ */
+typedef struct PoolStatistics_T {
+        long long checkouts;          /**< Connections handed out */
+        long long returns;            /**< Connections returned to the pool */
+        long long creations;          /**< Connections opened */
+        long long creationFailures;   /**< Failed attempts to open a connection */
+        long long pingFailures;       /**< Connections closed because they failed validation */
+        long long reaped;             /**< Connections closed by the pool because they were idle, dead, expired or in excess */
+        int peakActive;               /**< Highest number of active connections seen */
+        int size;                     /**< Current number of connections in the pool */
+        int active;                   /**< Current number of active connections */
+        int waiting;                  /**< Current number of callers waiting for a connection */
+        int maxConnections;           /**< Maximum number of connections */
+        Histogram_T checkoutWait;     /**< Time spent getting a connection from the pool */
+        Histogram_T holdTime;         /**< Time a connection was checked out */
+        Histogram_T connectTime;      /**< Time spent opening a new connection */
+} PoolStatistics_T;
+
 /**
  * Library Debug flag. If set to true, emit debug output 
  */
@@ -335,6 +439,57 @@ void ConnectionPool_setConnectionTimeout(T P, int connectionTimeout);
 int ConnectionPool_getConnectionTimeout(T P);
 
 
+/**
+ * Set when the pool should validate Connections. The default policy,
+ * <code>Validation_onCheckout</code>, test a Connection with 
+ * Connection_ping() before it is handed out by ConnectionPool_getConnection().
+ * Each ping may cost a round-trip to the database server. With
+ * <code>Validation_onReturn</code> a Connection is instead tested when it
+ * is returned to the pool, outside of the request path. With 
+ * <code>Validation_background</code> only the reaper thread tests idle 
+ * Connections, every sweep interval set with ConnectionPool_setReaper(). 
+ * ConnectionPool_start() starts the reaper thread for this policy even if
+ * ConnectionPool_setReaper() was not called, in which case idle Connections
+ * are validated every 60 seconds but not closed for inactivity. It is a 
+ * checked runtime error to select <code>Validation_background</code> after
+ * the pool was started without a reaper thread. Connections failing 
+ * validation are closed and removed from the pool.
+ * @param P A ConnectionPool object
+ * @param validation The validation policy
+ * @see ConnectionPool_setValidationWindow()
+ */
+void ConnectionPool_setValidation(T P, Validation_T validation);
+
+
+/**
+ * Returns the Connection validation policy used by the pool
+ * @param P A ConnectionPool object
+ * @return The validation policy
+ */
+Validation_T ConnectionPool_getValidation(T P);
+
+
+/**
+ * Only applicable with the <code>Validation_onCheckout</code> policy. A 
+ * Connection which was returned to the pool less than <code>ms</code> 
+ * milliseconds ago is assumed to be alive and is handed out without a
+ * ping. The default is 0, which means a Connection is always pinged
+ * before it is handed out.
+ * @param P A ConnectionPool object
+ * @param ms The validation window in milliseconds (ms >= 0)
+ */
+void ConnectionPool_setValidationWindow(T P, int ms);
+
+
+/**
+ * Returns the validation window in milliseconds
+ * @param P A ConnectionPool object
+ * @return The number of milliseconds a returned Connection is assumed
+ * to be alive without a ping
+ */
+int ConnectionPool_getValidationWindow(T P);
+
+
 /**
  * Set the function to call if a fatal error occurs in the library. In 
  * practice this means Out-Of-Memory errors or uncatched exceptions.
@@ -372,6 +527,322 @@ void ConnectionPool_setAbortHandler(T P, void(*abortHandler)(const char *error))
 void ConnectionPool_setReaper(T P, int sweepInterval);
 
 
+/**
+ * Set the minimum number of idle connections the pool should try to keep
+ * ready. If the number of idle connections drops below this watermark, the
+ * reaper thread opens new connections in the background, never exceeding
+ * maxConnections. This way the first requests in a burst of traffic do not
+ * have to wait for a new connection to be established. The reaper thread 
+ * does not close idle connections below this watermark. Setting 
+ * <code>minIdle</code> to a value greater than zero will start the reaper 
+ * thread in ConnectionPool_start() even if ConnectionPool_setReaper() was
+ * not called. The watermark may also be changed after the pool was started
+ * and the reaper thread applies the new value at once, but if the pool was
+ * started without a reaper thread, a new watermark has no effect until the
+ * pool is restarted. The default is 0, i.e. no background connections.
+ * @param P A ConnectionPool object
+ * @param minIdle The minimum number of idle connections. It is a checked
+ * runtime error for minIdle to be less than zero or greater than maxConnections
+ */
+void ConnectionPool_setMinIdle(T P, int minIdle);
+
+
+/**
+ * Returns the minimum number of idle connections the pool should keep ready
+ * @param P A ConnectionPool object
+ * @return The minimum number of idle connections
+ */
+int ConnectionPool_getMinIdle(T P);
+
+
+/**
+ * Split idle connections into <code>shards</code> sub-pools, each with its
+ * own lock. A thread gets and returns connections from the sub-pool of the
+ * CPU it runs on and steals a connection from a neighbour sub-pool if its own 
+ * is empty. Sharding reduces lock contention when many threads on many cores
+ * use the pool concurrently. Limits such as maxConnections and methods like
+ * ConnectionPool_size() and ConnectionPool_active() apply to the pool as a 
+ * whole. The default is 1, i.e. one idle list for the whole pool. This 
+ * method must be called <b>before</b> ConnectionPool_start().
+ * @param P A ConnectionPool object
+ * @param shards Number of sub-pools. If 0, one sub-pool per online CPU is 
+ * used. It is a checked runtime error for shards to be less than zero or for
+ * the pool to be started.
+ */
+void ConnectionPool_setShards(T P, int shards);
+
+
+/**
+ * Returns the number of sub-pools idle connections are split into
+ * @param P A ConnectionPool object
+ * @return The number of sub-pools
+ */
+int ConnectionPool_getShards(T P);
+
+
+/**
+ * Set the maximum lifetime in seconds of a connection. A connection is 
+ * retired after a randomized lifetime between 80% and 100% of this value so 
+ * connections opened at the same time are not recycled at the same time. 
+ * Long-lived connections can accumulate server-side memory and recycling 
+ * them also let load balancers in front of the database rebalance 
+ * connections. The reaper thread opens a replacement before an expired idle
+ * connection is closed so idle capacity does not drop. An expired connection
+ * returned to the pool is closed and replaced in the background. The default
+ * is 0, i.e. connections are not retired because of their age. This method 
+ * must be called <b>before</b> ConnectionPool_start().
+ * @param P A ConnectionPool object
+ * @param maxLifetime The maximum lifetime in seconds or 0 to disable. It is
+ * a checked runtime error for maxLifetime to be less than zero
+ */
+void ConnectionPool_setMaxLifetime(T P, int maxLifetime);
+
+
+/**
+ * Returns the maximum lifetime in seconds of a connection
+ * @param P A ConnectionPool object
+ * @return The maximum lifetime in seconds or 0 if disabled
+ * @see ConnectionPool_setMaxLifetime
+ */
+int ConnectionPool_getMaxLifetime(T P);
+
+
+/**
+ * Reserve a number of connections for high priority callers. Normal priority
+ * callers can have at most maxConnections - reserved connections checked out
+ * at the same time, while high priority callers can use all connections. A 
+ * burst of normal priority work, such as batch jobs, can then not take every
+ * connection from latency critical callers. The default is 0, i.e. no 
+ * connections are reserved. This method must be called <b>before</b> 
+ * ConnectionPool_start().
+ * @param P A ConnectionPool object
+ * @param reserved Number of connections reserved for high priority callers. 
+ * It is a checked runtime error for reserved to be less than zero or not 
+ * less than maxConnections
+ * @see ConnectionPool_getConnectionWithPriority
+ */
+void ConnectionPool_setReserved(T P, int reserved);
+
+
+/**
+ * Returns the number of connections reserved for high priority callers
+ * @param P A ConnectionPool object
+ * @return The number of reserved connections
+ */
+int ConnectionPool_getReserved(T P);
+
+
+/**
+ * Enable or disable adaptive pool sizing. With adaptive sizing, the reaper
+ * thread runs a controller which every few seconds computes a target pool 
+ * size from the checkout rate, the time connections are held, the time it
+ * takes to open a connection and the number of callers which had to wait for
+ * a connection. The pool is grown to the target in the background and idle
+ * connections above the target are closed gradually. The target is kept
+ * between initialConnections and maxConnections. This can be used to keep 
+ * fewer idle connections open when the load is low, while having connections
+ * ready at peak load. The default is false. This method must be called 
+ * <b>before</b> ConnectionPool_start().
+ * @param P A ConnectionPool object
+ * @param adaptive true to enable adaptive sizing, otherwise false
+ * @see ConnectionPool_getTargetSize
+ */
+void ConnectionPool_setAdaptiveSizing(T P, bool adaptive);
+
+
+/**
+ * Returns true if adaptive pool sizing is enabled
+ * @param P A ConnectionPool object
+ * @return true if adaptive sizing is enabled, otherwise false
+ */
+bool ConnectionPool_getAdaptiveSizing(T P);
+
+
+/**
+ * Returns the pool size computed by the adaptive sizing controller.
+ * @param P A ConnectionPool object
+ * @return The target pool size or maxConnections if adaptive sizing
+ * is not enabled
+ * @see ConnectionPool_setAdaptiveSizing
+ */
+int ConnectionPool_getTargetSize(T P);
+
+
+/**
+ * Enable or disable thread affinity. With thread affinity enabled,
+ * ConnectionPool_returnConnection() parks the connection in a slot owned by
+ * the calling thread instead of returning it to the idle list. The next call
+ * to ConnectionPool_getConnection() from the same thread gets the same 
+ * connection back without taking the pool lock. This is useful for
+ * applications where a thread gets and returns a connection many times 
+ * while serving a request and benefit from using the same connection and its
+ * server-side state. A parked connection is still available to other threads;
+ * if the pool runs short, or a thread is waiting for a connection, parked 
+ * connections are reclaimed and handed out. The reaper also reclaims parked
+ * connections which have not been used during its last sweep interval and
+ * a connection is given back to the pool when the thread owning the slot 
+ * exits. Parked connections are counted as idle connections. The default
+ * is false. This method must be called <b>before</b> ConnectionPool_start().
+ * @param P A ConnectionPool object
+ * @param affinity true to park returned connections with the thread,
+ * otherwise false
+ */
+void ConnectionPool_setThreadAffinity(T P, bool affinity);
+
+
+/**
+ * Set the number of PreparedStatements cached per connection. With a cache,
+ * PreparedStatements are not closed when a connection is returned to the 
+ * pool. Connection_prepareStatement() returns a cached statement, with its
+ * parameters reset to SQL NULL, if the same SQL was prepared on the 
+ * connection before. This saves the server from parsing and planning the
+ * statement again on each checkout. When the cache is full, the least 
+ * recently used statement is closed. A statement is only handed out once per
+ * checkout, preparing the same SQL again before the connection is returned
+ * creates a new statement. Caching is supported for MySQL, PostgreSQL and
+ * SQLite. The default is 0, i.e. no cache. This method must be called 
+ * <b>before</b> ConnectionPool_start().
+ * @param P A ConnectionPool object
+ * @param size The maximum number of cached PreparedStatements per connection
+ * @see Connection_prepareStatement
+ */
+void ConnectionPool_setStatementCacheSize(T P, int size);
+
+
+/**
+ * Returns the number of PreparedStatements cached per connection
+ * @param P A ConnectionPool object
+ * @return The statement cache size
+ * @see ConnectionPool_setStatementCacheSize
+ */
+int ConnectionPool_getStatementCacheSize(T P);
+
+
+/**
+ * Register a SQL statement which is prepared on every connection when the
+ * connection is created, including connections added later by a checkout,
+ * the reaper or by adaptive sizing. The statements are prepared together
+ * with the connect and outside the pool lock. The returned handle is used 
+ * with Connection_getStatement() to get the prepared statement on a checked
+ * out connection without a round trip to the server. Parameters are reset 
+ * when the connection is returned to the pool. If a statement cannot be 
+ * prepared on a new connection, it is prepared on first use. Statements must be 
+ * registered <b>before</b> ConnectionPool_start() and are copied to
+ * replicas added with ConnectionPool_addReplica().
+ * <pre>
+ * int insert = ConnectionPool_registerStatement(pool, "insert into employee(name) values(?)");
+ * ConnectionPool_start(pool);
+ * Connection_T con = ConnectionPool_getConnection(pool);
+ * PreparedStatement_T p = Connection_getStatement(con, insert);
+ * PreparedStatement_setString(p, 1, "Kim");
+ * PreparedStatement_execute(p);
+ * </pre>
+ * @param P A ConnectionPool object
+ * @param sql The SQL statement to register
+ * @return A statement handle, a positive number
+ * @see Connection_getStatement
+ */
+int ConnectionPool_registerStatement(T P, const char *sql);
+
+
+/**
+ * Returns true if returned connections are parked with the thread
+ * @param P A ConnectionPool object
+ * @return true if thread affinity is enabled, otherwise false
+ * @see ConnectionPool_setThreadAffinity
+ */
+bool ConnectionPool_getThreadAffinity(T P);
+
+
+/**
+ * Enable the circuit breaker. If the database cannot be reached, every 
+ * checkout which finds no idle connection would otherwise try to open a 
+ * new connection and block for the connect timeout. With the circuit breaker
+ * enabled, the breaker opens after <code>failures</code> consecutive failed 
+ * connection attempts and for <code>backoff</code> milliseconds checkouts
+ * which need a new connection fail immediately and waiting callers are 
+ * released. Idle connections are still handed out. After the back-off, a 
+ * single connection attempt is let through to probe the database. If it 
+ * succeeds the breaker closes, otherwise it opens again for a new back-off
+ * period. Connections opened in the background are subject to the breaker
+ * as well. Setting <code>failures</code> to 0 disables the circuit breaker,
+ * which is the default. 
+ * @param P A ConnectionPool object
+ * @param failures Number of consecutive failed connection attempts which 
+ * opens the breaker or 0 to disable the breaker
+ * @param backoff Milliseconds the breaker stays open before a probe is let
+ * through
+ * @see ConnectionPool_getCircuitBreaker
+ */
+void ConnectionPool_setCircuitBreaker(T P, int failures, int backoff);
+
+
+/**
+ * Add a tenant to the pool. Applications serving many tenants through one
+ * pool can check out connections for a tenant with 
+ * ConnectionPool_getConnectionForTenant() so a single tenant cannot hold 
+ * every connection in the pool. A tenant never holds more than 
+ * <code>maxActive</code> connections. The first <code>minimum</code>
+ * connections are guaranteed to the tenant and are not used by other 
+ * tenants or by callers without a tenant, the rest of the pool is shared. 
+ * The sum of the guaranteed minimums cannot exceed maxConnections. This
+ * method must be called <b>before</b> ConnectionPool_start() and after
+ * ConnectionPool_setMaxConnections().
+ * @param P A ConnectionPool object
+ * @param name The tenant name
+ * @param maxActive The maximum number of connections the tenant can hold
+ * @param minimum The number of connections guaranteed to the tenant
+ * (0 <= minimum <= maxActive)
+ * @return The tenant id used with ConnectionPool_getConnectionForTenant()
+ */
+int ConnectionPool_addTenant(T P, const char *name, int maxActive, int minimum);
+
+
+/**
+ * Returns the id of a tenant
+ * @param P A ConnectionPool object
+ * @param name The tenant name
+ * @return The tenant id or 0 if no tenant with the name was added
+ * @see ConnectionPool_addTenant
+ */
+int ConnectionPool_getTenant(T P, const char *name);
+
+
+/**
+ * Returns the state of the circuit breaker. The state is 
+ * CircuitBreaker_halfOpen when the back-off period has expired and the next
+ * connection attempt will probe the database.
+ * @param P A ConnectionPool object
+ * @return The circuit breaker state. CircuitBreaker_closed if the breaker
+ * is disabled
+ * @see ConnectionPool_setCircuitBreaker
+ */
+CircuitBreaker_T ConnectionPool_getCircuitBreaker(T P);
+
+
+/**
+ * Add a read replica of the database. The pool keeps a separate set of 
+ * connections to each replica, created with the same properties as the 
+ * primary pool when ConnectionPool_start() is called. A replica which cannot
+ * be reached at start or which later fails a health check is not used until
+ * it responds again. This method must be called <b>before</b> 
+ * ConnectionPool_start(). The caller retains ownership of <code>url</code>,
+ * which must remain valid for the lifetime of the pool.
+ * @param P A ConnectionPool object
+ * @param url The database connection URL of the replica
+ * @see ConnectionPool_getReadConnection
+ */
+void ConnectionPool_addReplica(T P, URL_T url);
+
+
+/**
+ * Returns the number of read replicas added to the pool
+ * @param P A ConnectionPool object
+ * @return The number of replicas
+ */
+int ConnectionPool_getReplicas(T P);
+
+
 /**
  * Returns the current number of connections in the pool. The number of 
  * both active and inactive connections are returned.
@@ -389,12 +860,83 @@ int ConnectionPool_size(T P);
  */
 int ConnectionPool_active(T P);
 
+
+/**
+ * Get a snapshot of the pool's statistics. Counters are kept with atomic 
+ * operations, per sub-pool, so maintaining them is cheap and taking a 
+ * snapshot does not lock the pool. Because the pool is not locked, the
+ * values in a snapshot may be slightly inconsistent with each other while
+ * the pool is in use.
+ * @param P A ConnectionPool object
+ * @param statistics The snapshot is written to this object
+ * @see ConnectionPool_setShards
+ */
+void ConnectionPool_getStatistics(T P, PoolStatistics_T *statistics);
+
+
+/**
+ * Render the pool's gauges, counters and latency histograms in the 
+ * OpenMetrics text format, which Prometheus can scrape. Metric names are
+ * prefixed with <code>zdb_pool_</code> and latencies are in seconds. The
+ * method does not lock the pool or allocate memory and is cheap enough to
+ * call from a scrape endpoint on a busy pool. Example:
+ * <pre>
+ * char buffer[8192];
+ * int n = ConnectionPool_renderMetrics(pool, "orders", buffer, sizeof(buffer));
+ * if (n < sizeof(buffer))
+ *      send(buffer, n);
+ * </pre>
+ * The output ends with the OpenMetrics <code># EOF</code> line, so each pool
+ * should be exposed on its own endpoint.
+ * @param P A ConnectionPool object
+ * @param name Value of a <code>pool</code> label added to every metric or
+ * NULL for no label
+ * @param buffer The buffer to write to. The output is always NUL terminated
+ * if size is greater than 0
+ * @param size Size of buffer
+ * @return Length of the output, excluding the terminating NUL byte. As with
+ * snprintf(3), if the return value is size or more, the output was truncated
+ * and the return value is the buffer size required minus 1
+ * @see ConnectionPool_getStatistics
+ */
+int ConnectionPool_renderMetrics(T P, const char *name, char *buffer, int size);
+
+
+/**
+ * Returns the number of connections in the pool on which the registered
+ * statement is prepared
+ * @param P A ConnectionPool object
+ * @param handle A handle returned by ConnectionPool_registerStatement()
+ * @return The number of connections with the statement prepared
+ */
+int ConnectionPool_prepared(T P, int handle);
+
+
+/**
+ * Returns the number of callers currently waiting for a connection in
+ * ConnectionPool_getConnectionWithTimeout()
+ * @param P A ConnectionPool object
+ * @return The number of waiting callers
+ */
+int ConnectionPool_waiting(T P);
+
+
+/**
+ * Returns the number of milliseconds the longest waiting caller has been
+ * waiting for a connection in ConnectionPool_getConnectionWithTimeout()
+ * @param P A ConnectionPool object
+ * @return The wait time in milliseconds or 0 if no caller is waiting
+ */
+long long ConnectionPool_waitTime(T P);
+
 //@}
 
 /**
  * Prepare for the beginning of active use of this component. This method
  * must be called before the pool is used and will connect to the database
- * server and create the initial connections for the pool. This method will
+ * server and create the initial connections for the pool. Initial connections
+ * are established concurrently, using up to 8 threads. The pool is started
+ * if at least one connection could be established. This method will
  * also start the reaper thread if specified via ConnectionPool_setReaper().
  * @param P A ConnectionPool object
  * @exception SQLException If a database error occurs.
@@ -423,6 +965,80 @@ void ConnectionPool_stop(T P);
 Connection_T ConnectionPool_getConnection(T P);
 
 
+/**
+ * Get a connection from the pool and wait up to <code>ms</code> milliseconds
+ * for a connection to become available if maxConnections is reached. Waiting
+ * callers are placed in a queue and a connection returned to the pool is 
+ * handed directly to the caller who has waited the longest. Calling this
+ * method with <code>ms</code> set to 0 is the same as calling 
+ * ConnectionPool_getConnection().
+ * @param P A ConnectionPool object
+ * @param ms Maximum number of milliseconds to wait for a connection (ms >= 0)
+ * @return A connection from the pool or NULL if no connection became 
+ * available within the timeout or if the pool was stopped while waiting
+ * @see Connection.h
+ */
+Connection_T ConnectionPool_getConnectionWithTimeout(T P, int ms);
+
+
+/**
+ * Get a connection from the pool as a caller of the given priority class and
+ * wait up to <code>ms</code> milliseconds for a connection. A high priority 
+ * caller can use connections reserved with ConnectionPool_setReserved() and 
+ * waiting high priority callers are served before waiting normal priority 
+ * callers when a connection is returned. Calling this method with 
+ * Priority_normal is the same as calling ConnectionPool_getConnectionWithTimeout().
+ * @param P A ConnectionPool object
+ * @param priority The priority class of the caller
+ * @param ms Maximum number of milliseconds to wait for a connection (ms >= 0)
+ * @return A connection from the pool or NULL if no connection became 
+ * available within the timeout or if the pool was stopped while waiting
+ * @see Connection.h
+ */
+Connection_T ConnectionPool_getConnectionWithPriority(T P, Priority_T priority, int ms);
+
+
+/**
+ * Get a connection for read-only work. The connection is taken from a 
+ * healthy replica, chosen at random and weighted by the inverse of its 
+ * observed latency. If the chosen replica has no connection available, the
+ * other healthy replicas are tried and if no replica can serve the request 
+ * or none are added, a connection is taken from the primary pool. The 
+ * connection is returned with Connection_close() as usual. 
+ * @param P A ConnectionPool object
+ * @return A connection to a replica or to the primary database, or NULL if
+ * maxConnection is reached
+ * @see ConnectionPool_addReplica
+ */
+Connection_T ConnectionPool_getReadConnection(T P);
+
+
+/**
+ * Get a connection from the pool for a tenant and wait up to <code>ms</code>
+ * milliseconds for a connection if the tenant's quota or the pool is 
+ * exhausted. Waiting callers are served in FIFO order as in 
+ * ConnectionPool_getConnectionWithTimeout(), but a caller is passed over 
+ * while its tenant holds its max active connections.
+ * @param P A ConnectionPool object
+ * @param tenant The tenant id returned by ConnectionPool_addTenant()
+ * @param ms Maximum number of milliseconds to wait for a connection (ms >= 0)
+ * @return A connection from the pool or NULL if the tenant already holds 
+ * its max active connections, or the pool is exhausted, and no connection
+ * became available within the timeout
+ * @see ConnectionPool_addTenant
+ */
+Connection_T ConnectionPool_getConnectionForTenant(T P, int tenant, int ms);
+
+
+/**
+ * Get the usage counters of a tenant
+ * @param P A ConnectionPool object
+ * @param tenant The tenant id
+ * @param statistics The counters of the tenant are stored here
+ */
+void ConnectionPool_getTenantStatistics(T P, int tenant, TenantStatistics_T *statistics);
+
+
 /**
  * Returns a connection to the pool. The same as calling Connection_close()
  * @param P A ConnectionPool object
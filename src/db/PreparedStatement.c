@@ -26,9 +26,13 @@
 #include "Config.h"
 
 #include <stdio.h>
+#include <string.h>
 
+#include "URL.h"
+#include "Vector.h"
 #include "ResultSet.h"
 #include "PreparedStatement.h"
+#include "Connection.h"
 
 
 /**
@@ -45,7 +49,15 @@
 struct PreparedStatement_S {
         Pop_T op;
         ResultSet_T resultSet;
+        Connection_T connection;
         PreparedStatementDelegate_T D;
+        int parameterCount;
+        Param_T *params;              // Parameters set, by reference. Only recorded if the delegate cannot read back its parameters
+        Vector_T batch;               // Rows of Param_T added with addBatch, values copied
+        Param_T *bound;               // Last row of an executed batch, still bound in a delegate without clear
+        int batchRows;                // Rows in the last executed batch
+        long long *batchRowsChanged;
+        char **batchErrors;
 };
 
 
@@ -58,6 +70,80 @@ static void _clearResultSet(T P) {
 }
 
 
+/* Record a parameter set by the caller for a delegate without getParameters. The index was already checked by the delegate */
+static Param_T *_param(T P, int parameterIndex, ParamType_T type) {
+        if (! P->params) {
+                P->parameterCount = P->op->parameterCount(P->D);
+                P->params = CALLOC(P->parameterCount, sizeof(Param_T));
+        }
+        Param_T *p = &P->params[parameterIndex - 1];
+        p->type = type;
+        p->size = 0;
+        return p;
+}
+
+
+static void _freeRow(T P, Param_T **row) {
+        for (int i = 0; i < P->parameterCount; i++) {
+                if ((*row)[i].type == Param_string || (*row)[i].type == Param_blob) {
+                        void *value = (void *)(*row)[i].value.blob;
+                        FREE(value);
+                }
+        }
+        FREE(*row);
+}
+
+
+static void _clearBatch(T P) {
+        if (P->bound)
+                _freeRow(P, &P->bound);
+        if (P->batch) {
+                while (! Vector_isEmpty(P->batch)) {
+                        Param_T *row = Vector_pop(P->batch);
+                        _freeRow(P, &row);
+                }
+        }
+        if (P->params)
+                memset(P->params, 0, P->parameterCount * sizeof(Param_T));
+}
+
+
+static void _clearBatchResult(T P) {
+        for (int i = 0; i < P->batchRows; i++)
+                FREE(P->batchErrors[i]);
+        FREE(P->batchErrors);
+        FREE(P->batchRowsChanged);
+        P->batchRows = 0;
+}
+
+
+/* Execute the batch one row at a time, for drivers without an executeBatch operation */
+static void _executeRows(T P, Param_T **rows) {
+        for (int i = 0; i < P->batchRows; i++) {
+                TRY
+                {
+                        bindParameters(P->op, P->D, P->parameterCount, rows[i]);
+                        P->op->execute(P->D);
+                        P->batchRowsChanged[i] = P->op->rowsChanged(P->D);
+                }
+                ELSE
+                {
+                        P->batchRowsChanged[i] = -1;
+                        P->batchErrors[i] = Str_dup(Exception_frame.message);
+                }
+                END_TRY;
+        }
+}
+
+
+static int _checkBatchRow(T P, int row) {
+        int i = row - 1;
+        if (i < 0 || i >= P->batchRows)
+                THROW(SQLException, "Batch row is out of range");
+        return i;
+}
+
+
 /* ----------------------------------------------------- Protected methods */
 
 
@@ -79,10 +165,33 @@ T PreparedStatement_new(PreparedStatementDelegate_T D, Pop_T op) {
 void PreparedStatement_free(T *P) {
 	assert(P && *P);
         _clearResultSet((*P));
+        _clearBatch((*P));
+        _clearBatchResult((*P));
+        if ((*P)->batch)
+                Vector_free(&(*P)->batch);
+        FREE((*P)->params);
         (*P)->op->free(&((*P)->D));
 	FREE(*P);
 }
 
+
+void PreparedStatement_setConnection(T P, void *connection) {
+        assert(P);
+        P->connection = connection;
+}
+
+
+bool PreparedStatement_clear(T P) {
+        assert(P);
+        if (! P->op->clear)
+                return false;
+        _clearResultSet(P);
+        _clearBatch(P);
+        _clearBatchResult(P);
+        P->op->clear(P->D);
+        return true;
+}
+
 #ifdef PACKAGE_PROTECTED
 #pragma GCC visibility pop
 #endif
@@ -94,36 +203,51 @@ void PreparedStatement_free(T *P) {
 void PreparedStatement_setString(T P, int parameterIndex, const char *x) {
 	assert(P);
         P->op->setString(P->D, parameterIndex, x);
+        if (! P->op->getParameters)
+                _param(P, parameterIndex, x ? Param_string : Param_null)->value.s = x;
 }
 
 
 void PreparedStatement_setInt(T P, int parameterIndex, int x) {
 	assert(P);
         P->op->setInt(P->D, parameterIndex, x);
+        if (! P->op->getParameters)
+                _param(P, parameterIndex, Param_int)->value.i = x;
 }
 
 
 void PreparedStatement_setLLong(T P, int parameterIndex, long long x) {
 	assert(P);
         P->op->setLLong(P->D, parameterIndex, x);
+        if (! P->op->getParameters)
+                _param(P, parameterIndex, Param_llong)->value.ll = x;
 }
 
 
 void PreparedStatement_setDouble(T P, int parameterIndex, double x) {
 	assert(P);
         P->op->setDouble(P->D, parameterIndex, x);
+        if (! P->op->getParameters)
+                _param(P, parameterIndex, Param_double)->value.d = x;
 }
 
 
 void PreparedStatement_setBlob(T P, int parameterIndex, const void *x, int size) {
 	assert(P);
         P->op->setBlob(P->D, parameterIndex, x, size);
+        if (! P->op->getParameters) {
+                Param_T *p = _param(P, parameterIndex, x ? Param_blob : Param_null);
+                p->value.blob = x;
+                p->size = x ? size : 0;
+        }
 }
 
 
 void PreparedStatement_setTimestamp(T P, int parameterIndex, time_t x) {
         assert(P);
         P->op->setTimestamp(P->D, parameterIndex, x);
+        if (! P->op->getParameters)
+                _param(P, parameterIndex, Param_timestamp)->value.t = x;
 }
 
 
@@ -133,6 +257,8 @@ void PreparedStatement_setTimestamp(T P, int parameterIndex, time_t x) {
 void PreparedStatement_execute(T P) {
 	assert(P);
         _clearResultSet(P);
+        if (P->connection)
+                Connection_applyState(P->connection);
         P->op->execute(P->D);
 }
 
@@ -140,6 +266,8 @@ void PreparedStatement_execute(T P) {
 ResultSet_T PreparedStatement_executeQuery(T P) {
 	assert(P);
         _clearResultSet(P);
+        if (P->connection)
+                Connection_applyState(P->connection);
 	P->resultSet = P->op->executeQuery(P->D);
         if (! P->resultSet)
                 THROW(SQLException, "PreparedStatement_executeQuery");
@@ -153,6 +281,89 @@ long long PreparedStatement_rowsChanged(T P) {
 }
 
 
+/* ----------------------------------------------------------------- Batch */
+
+
+void PreparedStatement_addBatch(T P) {
+        assert(P);
+        if (! P->batch) {
+                P->parameterCount = P->op->parameterCount(P->D);
+                P->batch = Vector_new(64);
+        }
+        Param_T *row = CALLOC(P->parameterCount + 1, sizeof(Param_T));
+        if (P->op->getParameters)
+                P->op->getParameters(P->D, row);
+        else if (P->params)
+                memcpy(row, P->params, P->parameterCount * sizeof(Param_T));
+        for (int i = 0; i < P->parameterCount; i++) {
+                if (row[i].type == Param_string) {
+                        row[i].value.s = Str_dup(row[i].value.s);
+                } else if (row[i].type == Param_blob) {
+                        void *blob = ALLOC(row[i].size + 1);
+                        memcpy(blob, row[i].value.blob, row[i].size);
+                        row[i].value.blob = blob;
+                }
+        }
+        Vector_push(P->batch, row);
+}
+
+
+int PreparedStatement_getBatchSize(T P) {
+        assert(P);
+        return P->batch ? Vector_size(P->batch) : 0;
+}
+
+
+long long PreparedStatement_executeBatch(T P) {
+        assert(P);
+        _clearResultSet(P);
+        _clearBatchResult(P);
+        if (! P->batch || Vector_isEmpty(P->batch))
+                return 0;
+        if (P->connection)
+                Connection_applyState(P->connection);
+        P->batchRows = Vector_size(P->batch);
+        P->batchRowsChanged = CALLOC(P->batchRows, sizeof(long long));
+        P->batchErrors = CALLOC(P->batchRows, sizeof(char *));
+        Param_T **rows = (Param_T **)Vector_toArray(P->batch);
+        if (! P->op->executeBatch || ! P->op->executeBatch(P->D, P->batchRows, rows, P->batchRowsChanged, P->batchErrors))
+                _executeRows(P, rows);
+        FREE(rows);
+        // The delegate may still reference values of the last row. Clear the delegate, or keep the row alive until the next batch
+        Param_T *last = P->op->clear ? NULL : Vector_pop(P->batch);
+        if (P->op->clear)
+                P->op->clear(P->D);
+        _clearBatch(P);
+        P->bound = last;
+        long long changed = 0;
+        int failed = 0, first = -1;
+        for (int i = 0; i < P->batchRows; i++) {
+                if (P->batchErrors[i]) {
+                        if (first < 0)
+                                first = i;
+                        failed++;
+                } else {
+                        changed += P->batchRowsChanged[i];
+                }
+        }
+        if (failed)
+                THROW(SQLException, "%d of %d batch rows failed, row %d -- %s", failed, P->batchRows, first + 1, P->batchErrors[first]);
+        return changed;
+}
+
+
+long long PreparedStatement_getBatchRowsChanged(T P, int row) {
+        assert(P);
+        return P->batchRowsChanged[_checkBatchRow(P, row)];
+}
+
+
+const char *PreparedStatement_getBatchError(T P, int row) {
+        assert(P);
+        return P->batchErrors[_checkBatchRow(P, row)];
+}
+
+
 /* ------------------------------------------------------------ Properties */
 
 
@@ -94,6 +94,24 @@
  * the Prepared Statement is executed again or until the Connection is
  * returned to the Connection Pool. 
  *
+ * <h2 class="desc">Batch</h2>
+ * Many rows can be sent with one call to PreparedStatement_executeBatch()
+ * instead of one PreparedStatement_execute() per row. Set the parameters of
+ * a row and call PreparedStatement_addBatch() to add it to the batch. The 
+ * parameter values are copied, so buffers can be reused for the next row.
+ * SQLite executes the batch in a single transaction unless a transaction 
+ * is already in progress and PostgreSQL sends the rows in a pipeline, 
+ * without waiting for the result of each row. Other databases execute the
+ * rows one by one.
+ * <pre>
+ * PreparedStatement_T p = Connection_prepareStatement(con, "insert into employee(name) values(?);");
+ * for (int i = 0; names[i]; i++) {
+ *         PreparedStatement_setString(p, 1, names[i]);
+ *         PreparedStatement_addBatch(p);
+ * }
+ * PreparedStatement_executeBatch(p);
+ * </pre>
+ *
  * <h2 class="desc">Date and Time</h2>
  * PreparedStatement provides PreparedStatement_setTimestamp() for setting a
  * Unix timestamp value. To set SQL Date, Time or DateTime values, simply use
@@ -130,6 +148,26 @@ T PreparedStatement_new(PreparedStatementDelegate_T D, Pop_T op);
  */
 void PreparedStatement_free(T *P);
 
+
+/**
+ * Close any ResultSet and reset all parameters to SQL NULL so the
+ * PreparedStatement can be reused. 
+ * @param P A PreparedStatement object
+ * @return true if the PreparedStatement was reset, false if the database
+ * implementation does not support reuse of a PreparedStatement
+ */
+bool PreparedStatement_clear(T P);
+
+
+/**
+ * Set the Connection this PreparedStatement was prepared on. Pending 
+ * session state on the Connection is applied before the statement is 
+ * executed.
+ * @param P A PreparedStatement object
+ * @param connection The Connection of the PreparedStatement
+ */
+void PreparedStatement_setConnection(T P, void *connection);
+
 //>> End Protected methods
 
 /** @name Parameters */
@@ -271,6 +309,66 @@ ResultSet_T PreparedStatement_executeQuery(T P);
 long long PreparedStatement_rowsChanged(T P);
 
 
+/** @name Batch */
+//@{
+
+/**
+ * Add the current parameter values as a row to the batch of this 
+ * PreparedStatement. String and blob values are copied. Parameters not
+ * set are SQL NULL.
+ * @param P A PreparedStatement object
+ * @see PreparedStatement_executeBatch
+ */
+void PreparedStatement_addBatch(T P);
+
+
+/**
+ * Returns the number of rows added with PreparedStatement_addBatch()
+ * and not yet executed
+ * @param P A PreparedStatement object
+ * @return The number of rows in the batch
+ */
+int PreparedStatement_getBatchSize(T P);
+
+
+/**
+ * Executes all rows in the batch and empties the batch. Every row is 
+ * tried even if a row fails, except on PostgreSQL where a failed row stops
+ * the batch and, outside a transaction, also rolls back the rows sent in
+ * the same pipeline. The result of each row is available with PreparedStatement_getBatchRowsChanged() and
+ * PreparedStatement_getBatchError() until the next batch is executed.
+ * Parameters should be set again after this method returns, the value of a
+ * parameter which is not set again is driver dependent.
+ * @param P A PreparedStatement object
+ * @return The total number of rows changed by the batch 
+ * @exception SQLException If one or more rows failed. The exception
+ * message is the error of the first failed row
+ */
+long long PreparedStatement_executeBatch(T P);
+
+
+/**
+ * Returns the number of rows changed by a row of the last executed batch
+ * @param P A PreparedStatement object
+ * @param row The batch row, the first row is 1
+ * @return The number of rows changed or -1 if the row failed
+ * @exception SQLException If row is out of range
+ */
+long long PreparedStatement_getBatchRowsChanged(T P, int row);
+
+
+/**
+ * Returns the error of a row of the last executed batch
+ * @param P A PreparedStatement object
+ * @param row The batch row, the first row is 1
+ * @return The error message or NULL if the row succeeded
+ * @exception SQLException If row is out of range
+ */
+const char *PreparedStatement_getBatchError(T P, int row);
+
+//@}
+
+
 /** @name Properties */
 //@{
 
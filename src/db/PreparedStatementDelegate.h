@@ -36,6 +36,30 @@
 #define T PreparedStatementDelegate_T
 typedef struct T *T;
 
+/* A parameter value of a batch row, see PreparedStatement_addBatch() */
+typedef enum {
+        Param_null = 0,
+        Param_string,
+        Param_int,
+        Param_llong,
+        Param_double,
+        Param_timestamp,
+        Param_blob
+} ParamType_T;
+
+typedef struct Param_T {
+        ParamType_T type;
+        union {
+                const char *s;
+                int i;
+                long long ll;
+                double d;
+                time_t t;
+                const void *blob;
+        } value;
+        int size;
+} Param_T;
+
 typedef struct Pop_T {
         const char *name;
         void (*free)(T *P);
@@ -49,6 +73,11 @@ typedef struct Pop_T {
         ResultSet_T (*executeQuery)(T P);
         long long (*rowsChanged)(T P);
         int (*parameterCount)(T P);
+        void (*clear)(T P);
+        // Optional. Execute a batch of parameter rows, setting rowsChanged[i] or -1 and errors[i] for a failed row. Return false to fall back to one execute per row
+        bool (*executeBatch)(T P, int rows, Param_T **params, long long *rowsChanged, char **errors);
+        // Optional. Read the parameters currently set into row, strings and blobs by reference. Without it, PreparedStatement records parameters as they are set
+        void (*getParameters)(T P, Param_T *row);
 } *Pop_T;
 
 /**
@@ -63,5 +92,23 @@ static inline int checkAndSetParameterIndex(int parameterIndex, int parameterCou
         return i;
 }
 
+
+/**
+ * Set all parameters of a batch row with the delegate's own setters
+ */
+static inline void bindParameters(Pop_T op, T P, int parameterCount, Param_T *row) {
+        for (int i = 0; i < parameterCount; i++) {
+                switch (row[i].type) {
+                        case Param_null:      op->setString(P, i + 1, NULL); break;
+                        case Param_string:    op->setString(P, i + 1, row[i].value.s); break;
+                        case Param_int:       op->setInt(P, i + 1, row[i].value.i); break;
+                        case Param_llong:     op->setLLong(P, i + 1, row[i].value.ll); break;
+                        case Param_double:    op->setDouble(P, i + 1, row[i].value.d); break;
+                        case Param_timestamp: op->setTimestamp(P, i + 1, row[i].value.t); break;
+                        case Param_blob:      op->setBlob(P, i + 1, row[i].value.blob, row[i].size); break;
+                }
+        }
+}
+
 #undef T
 #endif
@@ -0,0 +1,223 @@
+/*
+ * Copyright (C) Tildeslash Ltd. All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of portions of this program with the
+ * OpenSSL library under certain conditions as described in each
+ * individual source file, and distribute linked combinations
+ * including the two.
+ *
+ * You must obey the GNU General Public License in all respects
+ * for all of the code used other than OpenSSL.
+ */
+
+
+#include "Config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "URL.h"
+#include "Vector.h"
+#include "ResultSet.h"
+#include "PreparedStatement.h"
+#include "Connection.h"
+#include "ConnectionPool.h"
+#include "ShardRouter.h"
+
+
+/**
+ * Implementation of the ShardRouter interface
+ *
+ * @file
+ */
+
+
+/* ----------------------------------------------------------- Definitions */
+
+
+/* A point on the hash ring owned by a shard */
+typedef struct point_t {
+        uint64_t hash;
+        int shard;
+} *point_t;
+
+#define T ShardRouter_T
+struct ShardRouter_S {
+        Vector_T shards;
+        struct point_t *ring;
+        int points;
+        bool started;
+};
+
+
+/* ------------------------------------------------------- Private methods */
+
+
+/* FNV-1a with a final avalanche so similar keys spread over the whole ring */
+static uint64_t _hash(const char *key) {
+        uint64_t h = 14695981039346656037ULL;
+        for (const unsigned char *p = (const unsigned char *)key; *p; p++) {
+                h ^= *p;
+                h *= 1099511628211ULL;
+        }
+        h ^= h >> 33;
+        h *= 0xff51afd7ed558ccdULL;
+        h ^= h >> 33;
+        h *= 0xc4ceb9fe1a85ec53ULL;
+        h ^= h >> 33;
+        return h;
+}
+
+
+static int _comparePoints(const void *a, const void *b) {
+        const struct point_t *x = a, *y = b;
+        if (x->hash != y->hash)
+                return x->hash < y->hash ? -1 : 1;
+        return x->shard - y->shard;
+}
+
+
+/* Place a new shard at SQL_DEFAULT_SHARD_POINTS points on the ring */
+static void _addPoints(T R, int shard) {
+        char name[32];
+        long size = (R->points + SQL_DEFAULT_SHARD_POINTS) * sizeof *R->ring;
+        if (R->ring)
+                RESIZE(R->ring, size);
+        else
+                R->ring = ALLOC(size);
+        for (int i = 0; i < SQL_DEFAULT_SHARD_POINTS; i++) {
+                snprintf(name, sizeof(name), "shard-%d-%d", shard, i);
+                R->ring[R->points++] = (struct point_t){.hash = _hash(name), .shard = shard};
+        }
+        qsort(R->ring, R->points, sizeof *R->ring, _comparePoints);
+}
+
+
+/* ---------------------------------------------------------------- Public */
+
+
+T ShardRouter_new(void) {
+        T R;
+        NEW(R);
+        R->shards = Vector_new(16);
+        return R;
+}
+
+
+void ShardRouter_free(T *R) {
+        assert(R && *R);
+        while (! Vector_isEmpty((*R)->shards)) {
+                ConnectionPool_T pool = Vector_pop((*R)->shards);
+                ConnectionPool_free(&pool);
+        }
+        Vector_free(&(*R)->shards);
+        FREE((*R)->ring);
+        FREE(*R);
+}
+
+
+/* ------------------------------------------------------------ Properties */
+
+
+ConnectionPool_T ShardRouter_addShard(T R, URL_T url) {
+        assert(R);
+        assert(url);
+        assert(! R->started);
+        ConnectionPool_T pool = ConnectionPool_new(url);
+        _addPoints(R, Vector_size(R->shards));
+        Vector_push(R->shards, pool);
+        return pool;
+}
+
+
+int ShardRouter_size(T R) {
+        assert(R);
+        return Vector_size(R->shards);
+}
+
+
+ConnectionPool_T ShardRouter_getPool(T R, int shard) {
+        assert(R);
+        assert(shard >= 0 && shard < Vector_size(R->shards));
+        return Vector_get(R->shards, shard);
+}
+
+
+/* -------------------------------------------------------- Public methods */
+
+
+void ShardRouter_start(T R) {
+        assert(R);
+        assert(! Vector_isEmpty(R->shards));
+        volatile int i = 0;
+        TRY
+        {
+                for (; i < Vector_size(R->shards); i++)
+                        ConnectionPool_start(Vector_get(R->shards, i));
+        }
+        ELSE
+        {
+                // Stop the pools already started so a failed start leaves the router stopped
+                while (--i >= 0)
+                        ConnectionPool_stop(Vector_get(R->shards, i));
+                // RETHROW does not keep the message of the cause
+                Exception_throw(Exception_frame.exception, Exception_frame.func, Exception_frame.file, Exception_frame.line, "%s", Exception_frame.message);
+        }
+        END_TRY;
+        R->started = true;
+}
+
+
+void ShardRouter_stop(T R) {
+        assert(R);
+        for (int i = 0; i < Vector_size(R->shards); i++)
+                ConnectionPool_stop(Vector_get(R->shards, i));
+        R->started = false;
+}
+
+
+int ShardRouter_getShard(T R, const char *key) {
+        assert(R);
+        assert(key);
+        assert(R->points > 0);
+        uint64_t h = _hash(key);
+        // Binary search for the first point clockwise from the key, wrapping around to the first point
+        int lo = 0, hi = R->points;
+        while (lo < hi) {
+                int mid = lo + (hi - lo) / 2;
+                if (R->ring[mid].hash < h)
+                        lo = mid + 1;
+                else
+                        hi = mid;
+        }
+        return R->ring[lo == R->points ? 0 : lo].shard;
+}
+
+
+Connection_T ShardRouter_getConnection(T R, const char *key) {
+        return ShardRouter_getConnectionWithTimeout(R, key, 0);
+}
+
+
+Connection_T ShardRouter_getConnectionWithTimeout(T R, const char *key, int ms) {
+        return ConnectionPool_getConnectionWithTimeout(Vector_get(R->shards, ShardRouter_getShard(R, key)), ms);
+}
+
+
+void ShardRouter_getStatistics(T R, int shard, PoolStatistics_T *statistics) {
+        ConnectionPool_getStatistics(ShardRouter_getPool(R, shard), statistics);
+}
@@ -0,0 +1,192 @@
+/*
+ * Copyright (C) Tildeslash Ltd. All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of portions of this program with the
+ * OpenSSL library under certain conditions as described in each
+ * individual source file, and distribute linked combinations
+ * including the two.
+ *
+ * You must obey the GNU General Public License in all respects
+ * for all of the code used other than OpenSSL.
+ */
+
+
+
+#ifndef SHARDROUTER_INCLUDED
+#define SHARDROUTER_INCLUDED
+
+
+/**
+ * A <b>ShardRouter</b> routes database work to one of a set of connection
+ * pools based on a shard key.
+ *
+ * Applications with data partitioned over several databases can use a 
+ * ShardRouter instead of keeping a ConnectionPool per database together 
+ * with their own code for mapping keys to databases. Each database is
+ * added as a shard with ShardRouter_addShard(), which creates and returns 
+ * a ConnectionPool owned by the router. The pool can be configured with the
+ * usual ConnectionPool property methods before the router is started.
+ * 
+ * Keys are mapped to shards using consistent hashing. Each shard is placed
+ * at a number of points on a hash ring and a key belongs to the first shard
+ * found clockwise from the hash of the key. This spreads keys evenly over the
+ * shards and when a shard is added, only about 1/n of the keys move to the
+ * new shard, the rest stay where they were. The same set of shards added in
+ * the same order always maps a key to the same shard.
+ *
+ * <pre>
+ * ShardRouter_T router = ShardRouter_new();
+ * for (int i = 0; i < 16; i++)
+ *      ConnectionPool_setMaxConnections(ShardRouter_addShard(router, urls[i]), 50);
+ * ShardRouter_start(router);
+ * [..]
+ * Connection_T con = ShardRouter_getConnection(router, "customer:4711");
+ * if (con) {
+ *      ResultSet_T r = Connection_executeQuery(con, "select * from orders where customer = 4711");
+ *      [..]
+ *      Connection_close(con);
+ * }
+ * [..]
+ * ShardRouter_free(&router);
+ * </pre>
+ *
+ * ShardRouter_getStatistics() returns the statistics of each shard's pool
+ * so hot shards can be spotted.
+ *
+ * <i>A started ShardRouter is thread-safe. Shards must be added before the
+ * router is started.</i>
+ *
+ * @see ConnectionPool.h Connection.h URL.h
+ * @file
+ */
+
+
+#define T ShardRouter_T
+typedef struct ShardRouter_S *T;
+
+
+/**
+ * Create a new ShardRouter without shards
+ * @return A new ShardRouter object
+ * @see ShardRouter_addShard
+ */
+T ShardRouter_new(void);
+
+
+/**
+ * Disconnect and destroy the router and the connection pools of its shards
+ * @param R A ShardRouter object reference
+ */
+void ShardRouter_free(T *R);
+
+
+/** @name Properties */
+//@{
+
+/**
+ * Add a database shard to the router. A new ConnectionPool is created for 
+ * the database and returned so it can be configured before the router is
+ * started. The pool is owned by the router and freed by ShardRouter_free().
+ * The caller retains ownership of <code>url</code>, which must remain valid
+ * for the lifetime of the router. This method must be called <b>before</b>
+ * ShardRouter_start().
+ * @param R A ShardRouter object
+ * @param url The database connection URL of the shard
+ * @return The connection pool of the new shard
+ */
+ConnectionPool_T ShardRouter_addShard(T R, URL_T url);
+
+
+/**
+ * Returns the number of shards in the router
+ * @param R A ShardRouter object
+ * @return The number of shards
+ */
+int ShardRouter_size(T R);
+
+
+/**
+ * Returns the connection pool of a shard
+ * @param R A ShardRouter object
+ * @param shard The shard index, 0 for the first shard added
+ * @return The connection pool of the shard
+ */
+ConnectionPool_T ShardRouter_getPool(T R, int shard);
+
+//@}
+
+/**
+ * Start the connection pools of all shards
+ * @param R A ShardRouter object
+ * @exception SQLException if a pool could not be started
+ * @see SQLException.h
+ */
+void ShardRouter_start(T R);
+
+
+/**
+ * Stop the connection pools of all shards
+ * @param R A ShardRouter object
+ */
+void ShardRouter_stop(T R);
+
+
+/**
+ * Returns the index of the shard a key is mapped to
+ * @param R A ShardRouter object
+ * @param key The shard key
+ * @return The shard index
+ */
+int ShardRouter_getShard(T R, const char *key);
+
+
+/**
+ * Get a connection to the shard a key is mapped to. The connection is 
+ * returned to its pool with Connection_close() as usual.
+ * @param R A ShardRouter object
+ * @param key The shard key
+ * @return A connection from the shard's pool or NULL if maxConnection is 
+ * reached
+ * @see ConnectionPool_getConnection
+ */
+Connection_T ShardRouter_getConnection(T R, const char *key);
+
+
+/**
+ * Get a connection to the shard a key is mapped to and wait up to 
+ * <code>ms</code> milliseconds for a connection if the shard's pool is
+ * exhausted.
+ * @param R A ShardRouter object
+ * @param key The shard key
+ * @param ms Maximum number of milliseconds to wait for a connection (ms >= 0)
+ * @return A connection from the shard's pool or NULL if no connection became
+ * available within the timeout
+ * @see ConnectionPool_getConnectionWithTimeout
+ */
+Connection_T ShardRouter_getConnectionWithTimeout(T R, const char *key, int ms);
+
+
+/**
+ * Get the statistics of a shard's connection pool. 
+ * @param R A ShardRouter object
+ * @param shard The shard index
+ * @param statistics The statistics of the shard's pool are stored here
+ * @see ConnectionPool_getStatistics
+ */
+void ShardRouter_getStatistics(T R, int shard, PoolStatistics_T *statistics);
+
+
+#undef T
+#endif
@@ -138,7 +138,7 @@ error:
 }
 
 
-static bool _prepare(T C, const char *sql, int len, MYSQL_STMT **stmt) {
+static bool _prepare(T C, const char *sql, unsigned long len, MYSQL_STMT **stmt) {
         if (! (*stmt = mysql_stmt_init(C->db))) {
                 DEBUG("mysql_stmt_init -- Out of memory\n");
                 C->lastError = CR_OUT_OF_MEMORY;
@@ -186,6 +186,16 @@ static bool _ping(T C) {
 }
 
 
+static bool _isAlive(T C) {
+        assert(C);
+#ifdef HAVE_MYSQL_GET_SOCKET
+        return System_isSocketAlive(mysql_get_socket(C->db));
+#else
+        return System_isSocketAlive(C->db->net.fd);
+#endif
+}
+
+
 static void _setQueryTimeout(T C, int ms) {
         assert(C);
 #if MYSQL_VERSION_ID >= 50704
@@ -228,25 +238,27 @@ static long long _rowsChanged(T C) {
 }
 
 
-static bool _execute(T C, const char *sql, va_list ap) {
+static bool _execute_n(T C, const char *sql, size_t len) {
         assert(C);
-        va_list ap_copy;
-        va_copy(ap_copy, ap);
-        StringBuffer_vset(C->sb, sql, ap_copy);
-        va_end(ap_copy);
-        C->lastError = mysql_real_query(C->db, StringBuffer_toString(C->sb), StringBuffer_length(C->sb));
+        C->lastError = mysql_real_query(C->db, sql, len);
         return (C->lastError == MYSQL_OK);
 }
 
 
-static ResultSet_T _executeQuery(T C, const char *sql, va_list ap) {
+static bool _execute(T C, const char *sql, va_list ap) {
         assert(C);
         va_list ap_copy;
         va_copy(ap_copy, ap);
         StringBuffer_vset(C->sb, sql, ap_copy);
         va_end(ap_copy);
+        return _execute_n(C, StringBuffer_toString(C->sb), StringBuffer_length(C->sb));
+}
+
+
+static ResultSet_T _executeQuery_n(T C, const char *sql, size_t len) {
+        assert(C);
         MYSQL_STMT *stmt = NULL;
-        if (_prepare(C, StringBuffer_toString(C->sb), StringBuffer_length(C->sb), &stmt)) {
+        if (_prepare(C, sql, len, &stmt)) {
 #if MYSQL_VERSION_ID >= 50002
                 unsigned long cursor = CURSOR_TYPE_READ_ONLY;
                 mysql_stmt_attr_set(stmt, STMT_ATTR_CURSOR_TYPE, &cursor);
@@ -261,20 +273,36 @@ static ResultSet_T _executeQuery(T C, const char *sql, va_list ap) {
 }
 
 
-static PreparedStatement_T _prepareStatement(T C, const char *sql, va_list ap) {
+static ResultSet_T _executeQuery(T C, const char *sql, va_list ap) {
         assert(C);
         va_list ap_copy;
         va_copy(ap_copy, ap);
         StringBuffer_vset(C->sb, sql, ap_copy);
         va_end(ap_copy);
+        return _executeQuery_n(C, StringBuffer_toString(C->sb), StringBuffer_length(C->sb));
+}
+
+
+static PreparedStatement_T _prepareStatement_n(T C, const char *sql, size_t len) {
+        assert(C);
         MYSQL_STMT *stmt = NULL;
-        if (_prepare(C, StringBuffer_toString(C->sb), StringBuffer_length(C->sb), &stmt)) {
+        if (_prepare(C, sql, len, &stmt)) {
                 return PreparedStatement_new(MysqlPreparedStatement_new(C->delegator, stmt), (Pop_T)&mysqlpops);
         }
         return NULL;
 }
 
 
+static PreparedStatement_T _prepareStatement(T C, const char *sql, va_list ap) {
+        assert(C);
+        va_list ap_copy;
+        va_copy(ap_copy, ap);
+        StringBuffer_vset(C->sb, sql, ap_copy);
+        va_end(ap_copy);
+        return _prepareStatement_n(C, StringBuffer_toString(C->sb), StringBuffer_length(C->sb));
+}
+
+
 static const char *_getLastError(T C) {
         assert(C);
         if (mysql_errno(C->db))
@@ -291,6 +319,7 @@ const struct Cop_T mysqlcops = {
         .new 		  = _new,
         .free 		  = _free,
         .ping		  = _ping,
+        .isAlive	  = _isAlive,
         .setQueryTimeout  = _setQueryTimeout,
         .beginTransaction = _beginTransaction,
         .commit		  = _commit,
@@ -300,6 +329,9 @@ const struct Cop_T mysqlcops = {
         .execute	  = _execute,
         .executeQuery     = _executeQuery,
         .prepareStatement = _prepareStatement,
+        .execute_n        = _execute_n,
+        .executeQuery_n   = _executeQuery_n,
+        .prepareStatement_n = _prepareStatement_n,
         .getLastError     = _getLastError
 };
 
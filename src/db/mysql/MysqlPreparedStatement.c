@@ -54,6 +54,7 @@ typedef struct param_t {
 #define T PreparedStatementDelegate_T
 struct T {
         int lastError;
+        bool cursor;
         param_t params;
         MYSQL_STMT *stmt;
         MYSQL_BIND *bind;
@@ -213,6 +214,7 @@ static ResultSet_T _executeQuery(T P) {
 #if MYSQL_VERSION_ID >= 50002
         unsigned long cursor = CURSOR_TYPE_READ_ONLY;
         mysql_stmt_attr_set(P->stmt, STMT_ATTR_CURSOR_TYPE, &cursor);
+        P->cursor = true;
 #endif
         if ((P->lastError = mysql_stmt_execute(P->stmt)))
                 THROW(SQLException, "%s", mysql_stmt_error(P->stmt));
@@ -235,6 +237,60 @@ static int _parameterCount(T P) {
 }
 
 
+static void _getParameters(T P, Param_T *row) {
+        assert(P);
+        for (int i = 0; i < P->parameterCount; i++) {
+                MYSQL_BIND *b = &P->bind[i];
+                if (b->is_null && *b->is_null) {
+                        row[i] = (Param_T){.type = Param_null};
+                        continue;
+                }
+                switch (b->buffer_type) {
+                        case MYSQL_TYPE_STRING:
+                                row[i] = (Param_T){.type = Param_string, .value.s = b->buffer};
+                                break;
+                        case MYSQL_TYPE_BLOB:
+                                row[i] = (Param_T){.type = Param_blob, .value.blob = b->buffer, .size = (int)P->params[i].length};
+                                break;
+                        case MYSQL_TYPE_LONG:
+                                row[i] = (Param_T){.type = Param_int, .value.i = P->params[i].type.integer};
+                                break;
+                        case MYSQL_TYPE_LONGLONG:
+                                row[i] = (Param_T){.type = Param_llong, .value.ll = P->params[i].type.llong};
+                                break;
+                        case MYSQL_TYPE_DOUBLE:
+                                row[i] = (Param_T){.type = Param_double, .value.d = P->params[i].type.real};
+                                break;
+                        case MYSQL_TYPE_TIMESTAMP:
+                        {
+                                MYSQL_TIME *t = &P->params[i].type.timestamp;
+                                struct tm ts = {.tm_year = t->year - 1900, .tm_mon = t->month - 1, .tm_mday = t->day, 
+                                                .tm_hour = t->hour, .tm_min = t->minute, .tm_sec = t->second};
+                                row[i] = (Param_T){.type = Param_timestamp, .value.t = timegm(&ts)};
+                                break;
+                        }
+                        default:
+                                row[i] = (Param_T){.type = Param_null};
+                                break;
+                }
+        }
+}
+
+
+static void _clear(T P) {
+        assert(P);
+        mysql_stmt_free_result(P->stmt);
+        /* mysql_stmt_reset is a round trip to the server. Only needed to close a server side cursor
+         opened by executeQuery, long data is never sent and bind buffers are reset locally below */
+        if (P->cursor) {
+                mysql_stmt_reset(P->stmt);
+                P->cursor = false;
+        }
+        for (int i = 0; i < P->parameterCount; i++)
+                P->bind[i] = (MYSQL_BIND){.buffer_type = MYSQL_TYPE_NULL};
+}
+
+
 /* ------------------------------------------------------------------------- */
 
 
@@ -250,7 +306,8 @@ const struct Pop_T mysqlpops = {
         .execute        = _execute,
         .executeQuery   = _executeQuery,
         .rowsChanged    = _rowsChanged,
-        .parameterCount = _parameterCount
-
+        .parameterCount = _parameterCount,
+        .clear          = _clear,
+        .getParameters  = _getParameters
 };
 
@@ -27,6 +27,7 @@
 
 #include <stdio.h>
 #include <string.h>
+#include <limits.h>
 #include <stdatomic.h>
 
 #include "PostgresqlAdapter.h"
@@ -147,10 +148,19 @@ static T _new(Connection_T delegator, char **error) {
 
 static bool _ping(T C) {
         assert(C);
+        // Read whatever the server sent so a connection closed by the server is noticed
+        if (PQstatus(C->db) == CONNECTION_OK)
+                PQconsumeInput(C->db);
         return (PQstatus(C->db) == CONNECTION_OK);
 }
 
 
+static bool _isAlive(T C) {
+        assert(C);
+        return (PQstatus(C->db) == CONNECTION_OK) && System_isSocketAlive(PQsocket(C->db));
+}
+
+
 static void _setQueryTimeout(T C, int ms) {
         assert(C);
         StringBuffer_set(C->sb, "SET statement_timeout TO %d;", ms);
@@ -198,26 +208,42 @@ static long long _rowsChanged(T C) {
 }
 
 
-static bool _execute(T C, const char *sql, va_list ap) {
-	assert(C);
-        PQclear(C->res);
-        va_list ap_copy;
-        va_copy(ap_copy, ap);
-        StringBuffer_vset(C->sb, sql, ap_copy);
-        va_end(ap_copy);
+/* PQexec and PQprepare need a NUL terminated string, SQL with a length is copied verbatim to C->sb */
+static void _copy(T C, const char *sql, size_t len) {
+        if (len > INT_MAX)
+                THROW(SQLException, "SQL statement is too long -- %zu bytes", len);
+        StringBuffer_clear(C->sb);
+        StringBuffer_append(C->sb, "%.*s", (int)len, sql);
+}
+
+
+static bool _exec(T C) {
         C->res = PQexec(C->db, StringBuffer_toString(C->sb));
         C->lastError = PQresultStatus(C->res);
         return (C->lastError == PGRES_COMMAND_OK);
 }
 
 
-static ResultSet_T _executeQuery(T C, const char *sql, va_list ap) {
+static bool _execute(T C, const char *sql, va_list ap) {
 	assert(C);
         PQclear(C->res);
         va_list ap_copy;
         va_copy(ap_copy, ap);
         StringBuffer_vset(C->sb, sql, ap_copy);
         va_end(ap_copy);
+        return _exec(C);
+}
+
+
+static bool _execute_n(T C, const char *sql, size_t len) {
+	assert(C);
+        PQclear(C->res);
+        _copy(C, sql, len);
+        return _exec(C);
+}
+
+
+static ResultSet_T _execQuery(T C) {
         C->res = PQexec(C->db, StringBuffer_toString(C->sb));
         C->lastError = PQresultStatus(C->res);
         if (C->lastError == PGRES_TUPLES_OK)
@@ -226,14 +252,26 @@ static ResultSet_T _executeQuery(T C, const char *sql, va_list ap) {
 }
 
 
-static PreparedStatement_T _prepareStatement(T C, const char *sql, va_list ap) {
-        assert(C);
-        assert(sql);
+static ResultSet_T _executeQuery(T C, const char *sql, va_list ap) {
+	assert(C);
         PQclear(C->res);
         va_list ap_copy;
         va_copy(ap_copy, ap);
         StringBuffer_vset(C->sb, sql, ap_copy);
         va_end(ap_copy);
+        return _execQuery(C);
+}
+
+
+static ResultSet_T _executeQuery_n(T C, const char *sql, size_t len) {
+	assert(C);
+        PQclear(C->res);
+        _copy(C, sql, len);
+        return _execQuery(C);
+}
+
+
+static PreparedStatement_T _prepare(T C) {
         int paramCount = StringBuffer_prepare4postgres(C->sb);
         uint32_t t = kStatementID++; // increment is atomic
         char *name = Str_cat("__libzdb-%d", t);
@@ -245,6 +283,27 @@ static PreparedStatement_T _prepareStatement(T C, const char *sql, va_list ap) {
 }
 
 
+static PreparedStatement_T _prepareStatement(T C, const char *sql, va_list ap) {
+        assert(C);
+        assert(sql);
+        PQclear(C->res);
+        va_list ap_copy;
+        va_copy(ap_copy, ap);
+        StringBuffer_vset(C->sb, sql, ap_copy);
+        va_end(ap_copy);
+        return _prepare(C);
+}
+
+
+static PreparedStatement_T _prepareStatement_n(T C, const char *sql, size_t len) {
+        assert(C);
+        assert(sql);
+        PQclear(C->res);
+        _copy(C, sql, len);
+        return _prepare(C);
+}
+
+
 static const char *_getLastError(T C) {
 	assert(C);
         return C->res ? PQresultErrorMessage(C->res) : "unknown error";
@@ -259,6 +318,7 @@ const struct Cop_T postgresqlcops = {
         .new              = _new,
         .free             = _free,
         .ping             = _ping,
+        .isAlive          = _isAlive,
         .setQueryTimeout  = _setQueryTimeout,
         .beginTransaction = _beginTransaction,
         .commit           = _commit,
@@ -268,6 +328,9 @@ const struct Cop_T postgresqlcops = {
         .execute          = _execute,
         .executeQuery     = _executeQuery,
         .prepareStatement = _prepareStatement,
+        .execute_n        = _execute_n,
+        .executeQuery_n   = _executeQuery_n,
+        .prepareStatement_n = _prepareStatement_n,
         .getLastError     = _getLastError
 };
 
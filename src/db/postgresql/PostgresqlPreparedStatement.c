@@ -61,6 +61,7 @@ struct T {
         Connection_T delegator;
 };
 extern const struct Rop_T postgresqlrops;
+extern const struct Pop_T postgresqlpops;
 
 
 /* ------------------------------------------------------------- Constructor */
@@ -202,6 +203,98 @@ static int _parameterCount(T P) {
 }
 
 
+/* Numbers and timestamps are already converted to text, so a batch row gets them as strings */
+static void _getParameters(T P, Param_T *row) {
+        assert(P);
+        for (int i = 0; i < P->parameterCount; i++) {
+                if (! P->paramValues[i])
+                        row[i] = (Param_T){.type = Param_null};
+                else if (P->paramFormats[i])
+                        row[i] = (Param_T){.type = Param_blob, .value.blob = P->paramValues[i], .size = P->paramLengths[i]};
+                else
+                        row[i] = (Param_T){.type = Param_string, .value.s = P->paramValues[i]};
+        }
+}
+
+
+static void _clear(T P) {
+        assert(P);
+        PQclear(P->res);
+        P->res = NULL;
+        for (int i = 0; i < P->parameterCount; i++) {
+                P->paramValues[i] = NULL;
+                P->paramLengths[i] = 0;
+                P->paramFormats[i] = 0;
+        }
+}
+
+
+#ifdef LIBPQ_HAS_PIPELINING
+/* Send the batch in pipeline mode, at most SQL_DEFAULT_PIPELINE_DEPTH rows between syncs so neither side blocks on a full socket.
+ A failed row aborts the rest of its pipeline and no further rows are sent. Outside a transaction, the rows of a pipeline are one implicit 
+ transaction, so rows sent before the failed row are rolled back too */
+static bool _executeBatch(T P, int rows, Param_T **params, long long *rowsChanged, char **errors) {
+        assert(P);
+        bool implicit = PQtransactionStatus(P->db) == PQTRANS_IDLE;
+        if (! PQenterPipelineMode(P->db))
+                return false;
+        PQclear(P->res);
+        P->res = NULL;
+        bool failed = false;
+        for (int first = 0; first < rows; first += SQL_DEFAULT_PIPELINE_DEPTH) {
+                int last = MIN(first + SQL_DEFAULT_PIPELINE_DEPTH, rows);
+                int sent = first;
+                for (; ! failed && sent < last; sent++) {
+                        bindParameters((Pop_T)&postgresqlpops, P, P->parameterCount, params[sent]);
+                        if (! PQsendQueryPrepared(P->db, P->stmt, P->parameterCount, (const char **)P->paramValues, P->paramLengths, P->paramFormats, 0))
+                                break;
+                }
+                if (sent > first)
+                        PQpipelineSync(P->db);
+                for (int i = first; i < last; i++) {
+                        if (i >= sent) {
+                                rowsChanged[i] = -1;
+                                errors[i] = Str_dup(failed ? "Row not executed, a previous row in the batch failed" : PQerrorMessage(P->db));
+                                failed = true;
+                                continue;
+                        }
+                        PGresult *res = PQgetResult(P->db);
+                        ExecStatusType status = res ? PQresultStatus(res) : PGRES_FATAL_ERROR;
+                        if (status == PGRES_COMMAND_OK) {
+                                char *changes = PQcmdTuples(res);
+                                rowsChanged[i] = (changes && *changes) ? Str_parseLLong(changes) : 0;
+                        } else {
+                                rowsChanged[i] = -1;
+                                errors[i] = Str_dup(status == PGRES_PIPELINE_ABORTED ? "Row not executed, a previous row in the batch failed" : res ? PQresultErrorMessage(res) : PQerrorMessage(P->db));
+                                failed = true;
+                        }
+                        if (res) {
+                                PQclear(res);
+                                PQclear(PQgetResult(P->db)); // NULL, end of the results of this row
+                        }
+                }
+                // Consume the sync result of this pipeline
+                if (sent > first) {
+                        PGresult *res;
+                        while ((res = PQgetResult(P->db)) && PQresultStatus(res) != PGRES_PIPELINE_SYNC)
+                                PQclear(res);
+                        PQclear(res);
+                }
+                if (failed && implicit) {
+                        for (int i = first; i < last; i++) {
+                                if (! errors[i]) {
+                                        rowsChanged[i] = -1;
+                                        errors[i] = Str_dup("Row rolled back, another row in the same pipeline failed");
+                                }
+                        }
+                }
+        }
+        PQexitPipelineMode(P->db);
+        return true;
+}
+#endif
+
+
 /* ------------------------------------------------------------------------- */
 
 
@@ -217,6 +310,11 @@ const struct Pop_T postgresqlpops = {
         .execute        = _execute,
         .executeQuery   = _executeQuery,
         .rowsChanged    = _rowsChanged,
-        .parameterCount = _parameterCount
+        .parameterCount = _parameterCount,
+        .clear          = _clear,
+#ifdef LIBPQ_HAS_PIPELINING
+        .executeBatch   = _executeBatch,
+#endif
+        .getParameters  = _getParameters
 };
 
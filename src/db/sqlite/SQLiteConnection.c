@@ -148,6 +148,13 @@ static bool _ping(T C) {
 }
 
 
+static bool _isAlive(T C) {
+        assert(C);
+        // An embedded database has no server connection which can go away
+        return true;
+}
+
+
 static void _setQueryTimeout(T C, int ms) {
         assert(C);
         if (ms <= 0)
@@ -200,30 +207,54 @@ static bool _execute(T C, const char *sql, va_list ap) {
 }
 
 
-static ResultSet_T _executeQuery(T C, const char *sql, va_list ap) {
-        va_list ap_copy;
+/* Same as sqlite3_exec but with a length, so sql need not be NUL terminated */
+static bool _execute_n(T C, const char *sql, size_t len) {
         const char *tail;
+        const char *end = sql + len;
         sqlite3_stmt *stmt;
         assert(C);
-        va_copy(ap_copy, ap);
-        StringBuffer_vset(C->sb, sql, ap_copy);
-        va_end(ap_copy);
-        C->lastError = zdb_sqlite3_prepare_v2(C->db, StringBuffer_toString(C->sb), StringBuffer_length(C->sb), &stmt, &tail);
+        C->lastError = SQLITE_OK;
+        while (sql < end && C->lastError == SQLITE_OK) {
+                C->lastError = zdb_sqlite3_prepare_v2(C->db, sql, (int)(end - sql), &stmt, &tail);
+                if (C->lastError == SQLITE_OK && stmt) { // stmt is NULL for whitespace or a comment
+                        while ((C->lastError = zdb_sqlite3_step(stmt)) == SQLITE_ROW)
+                                ;
+                        if (C->lastError == SQLITE_DONE)
+                                C->lastError = SQLITE_OK;
+                        sqlite3_finalize(stmt);
+                }
+                sql = tail;
+        }
+        return (C->lastError == SQLITE_OK);
+}
+
+
+static ResultSet_T _executeQuery_n(T C, const char *sql, size_t len) {
+        const char *tail;
+        sqlite3_stmt *stmt;
+        assert(C);
+        C->lastError = zdb_sqlite3_prepare_v2(C->db, sql, (int)len, &stmt, &tail);
         if (C->lastError == SQLITE_OK)
                 return ResultSet_new(SQLiteResultSet_new(C->delegator, stmt, false), (Rop_T)&sqlite3rops);
         return NULL;
 }
 
 
-static PreparedStatement_T _prepareStatement(T C, const char *sql, va_list ap) {
+static ResultSet_T _executeQuery(T C, const char *sql, va_list ap) {
         va_list ap_copy;
-        const char *tail;
-        sqlite3_stmt *stmt;
         assert(C);
         va_copy(ap_copy, ap);
         StringBuffer_vset(C->sb, sql, ap_copy);
         va_end(ap_copy);
-        C->lastError = zdb_sqlite3_prepare_v2(C->db, StringBuffer_toString(C->sb), -1, &stmt, &tail);
+        return _executeQuery_n(C, StringBuffer_toString(C->sb), StringBuffer_length(C->sb));
+}
+
+
+static PreparedStatement_T _prepareStatement_n(T C, const char *sql, size_t len) {
+        const char *tail;
+        sqlite3_stmt *stmt;
+        assert(C);
+        C->lastError = zdb_sqlite3_prepare_v2(C->db, sql, (int)len, &stmt, &tail);
         if (C->lastError == SQLITE_OK) {
                 return PreparedStatement_new(SQLitePreparedStatement_new(C->delegator, stmt), (Pop_T)&sqlite3pops);
         }
@@ -231,6 +262,16 @@ static PreparedStatement_T _prepareStatement(T C, const char *sql, va_list ap) {
 }
 
 
+static PreparedStatement_T _prepareStatement(T C, const char *sql, va_list ap) {
+        va_list ap_copy;
+        assert(C);
+        va_copy(ap_copy, ap);
+        StringBuffer_vset(C->sb, sql, ap_copy);
+        va_end(ap_copy);
+        return _prepareStatement_n(C, StringBuffer_toString(C->sb), StringBuffer_length(C->sb));
+}
+
+
 static const char *_getLastError(T C) {
         assert(C);
         return sqlite3_errmsg(C->db);
@@ -245,6 +286,7 @@ const struct Cop_T sqlite3cops = {
         .new 		  = _new,
         .free 		  = _free,
         .ping		  = _ping,
+        .isAlive	  = _isAlive,
         .setQueryTimeout  = _setQueryTimeout,
         .beginTransaction = _beginTransaction,
         .commit           = _commit,
@@ -254,6 +296,9 @@ const struct Cop_T sqlite3cops = {
         .execute	  = _execute,
         .executeQuery	  = _executeQuery,
         .prepareStatement = _prepareStatement,
+        .execute_n        = _execute_n,
+        .executeQuery_n   = _executeQuery_n,
+        .prepareStatement_n = _prepareStatement_n,
         .getLastError	  = _getLastError
 };
 
@@ -48,10 +48,13 @@
 struct T {
         sqlite3 *db;
         int lastError;
+        int parameterCount;
+        Param_T *params;
         sqlite3_stmt *stmt;
         Connection_T delegator;
 };
 extern const struct Rop_T sqlite3rops;
+extern const struct Pop_T sqlite3pops;
 
 
 /* ------------------------------------------------------------- Constructor */
@@ -64,78 +67,97 @@ T SQLitePreparedStatement_new(Connection_T delegator, sqlite3_stmt *stmt) {
         P->delegator = delegator;
         P->stmt = stmt;
         P->db = sqlite3_db_handle(stmt);
+        P->parameterCount = sqlite3_bind_parameter_count(stmt);
+        if (P->parameterCount > 0)
+                P->params = CALLOC(P->parameterCount, sizeof(Param_T));
         P->lastError = SQLITE_OK;
         return P;
 }
 
 
+/* --------------------------------------------------------- Private methods */
+
+
+/* 
+ * Parameters are kept until the statement is executed and bound then. SQLite has no
+ * API to read back a bound value, keeping them lets getParameters read a batch row
+ */
+static void _bind(T P) {
+        sqlite3_reset(P->stmt);
+        P->lastError = SQLITE_OK;
+        for (int i = 0; i < P->parameterCount && P->lastError == SQLITE_OK; i++) {
+                Param_T *p = &P->params[i];
+                switch (p->type) {
+                        case Param_null:      P->lastError = sqlite3_bind_null(P->stmt, i + 1); break;
+                        case Param_string:    P->lastError = sqlite3_bind_text(P->stmt, i + 1, p->value.s, -1, SQLITE_STATIC); break;
+                        case Param_int:       P->lastError = sqlite3_bind_int(P->stmt, i + 1, p->value.i); break;
+                        case Param_llong:     P->lastError = sqlite3_bind_int64(P->stmt, i + 1, p->value.ll); break;
+                        case Param_double:    P->lastError = sqlite3_bind_double(P->stmt, i + 1, p->value.d); break;
+                        case Param_timestamp: P->lastError = sqlite3_bind_int64(P->stmt, i + 1, p->value.t); break;
+                        case Param_blob:      P->lastError = sqlite3_bind_blob(P->stmt, i + 1, p->value.blob, p->size, SQLITE_STATIC); break;
+                }
+        }
+}
+
+
 /* -------------------------------------------------------- Delegate Methods */
 
 
 static void _free(T *P) {
         assert(P && *P);
         sqlite3_finalize((*P)->stmt);
+        FREE((*P)->params);
         FREE(*P);
 }
 
 
 static void _setString(T P, int parameterIndex, const char *x) {
         assert(P);
-        sqlite3_reset(P->stmt);
-        int size = x ? (int)strlen(x) : 0;
-        P->lastError = sqlite3_bind_text(P->stmt, parameterIndex, x, size, SQLITE_STATIC);
-        if (P->lastError == SQLITE_RANGE)
-                THROW(SQLException, "Parameter index is out of range");
+        int i = checkAndSetParameterIndex(parameterIndex, P->parameterCount);
+        P->params[i] = (Param_T){.type = x ? Param_string : Param_null, .value.s = x};
 }
 
 
 static void _setInt(T P, int parameterIndex, int x) {
         assert(P);
-        sqlite3_reset(P->stmt);
-        P->lastError = sqlite3_bind_int(P->stmt, parameterIndex, x);
-        if (P->lastError == SQLITE_RANGE)
-                THROW(SQLException, "Parameter index is out of range");
+        int i = checkAndSetParameterIndex(parameterIndex, P->parameterCount);
+        P->params[i] = (Param_T){.type = Param_int, .value.i = x};
 }
 
 
 static void _setLLong(T P, int parameterIndex, long long x) {
         assert(P);
-        sqlite3_reset(P->stmt);
-        P->lastError = sqlite3_bind_int64(P->stmt, parameterIndex, x);
-        if (P->lastError == SQLITE_RANGE)
-                THROW(SQLException, "Parameter index is out of range");
+        int i = checkAndSetParameterIndex(parameterIndex, P->parameterCount);
+        P->params[i] = (Param_T){.type = Param_llong, .value.ll = x};
 }
 
 
 static void _setDouble(T P, int parameterIndex, double x) {
         assert(P);
-        sqlite3_reset(P->stmt);
-        P->lastError = sqlite3_bind_double(P->stmt, parameterIndex, x);
-        if (P->lastError == SQLITE_RANGE)
-                THROW(SQLException, "Parameter index is out of range");
+        int i = checkAndSetParameterIndex(parameterIndex, P->parameterCount);
+        P->params[i] = (Param_T){.type = Param_double, .value.d = x};
 }
 
 
 static void _setTimestamp(T P, int parameterIndex, time_t x) {
         assert(P);
-        sqlite3_reset(P->stmt);
-        P->lastError = sqlite3_bind_int64(P->stmt, parameterIndex, x);
-        if (P->lastError == SQLITE_RANGE)
-                THROW(SQLException, "Parameter index is out of range");
+        int i = checkAndSetParameterIndex(parameterIndex, P->parameterCount);
+        P->params[i] = (Param_T){.type = Param_timestamp, .value.t = x};
 }
 
 
 static void _setBlob(T P, int parameterIndex, const void *x, int size) {
         assert(P);
-        sqlite3_reset(P->stmt);
-        P->lastError = sqlite3_bind_blob(P->stmt, parameterIndex, x, size, SQLITE_STATIC);
-        if (P->lastError == SQLITE_RANGE)
-                THROW(SQLException, "Parameter index is out of range");
+        int i = checkAndSetParameterIndex(parameterIndex, P->parameterCount);
+        P->params[i] = (Param_T){.type = x ? Param_blob : Param_null, .value.blob = x, .size = x ? size : 0};
 }
 
 
 static void _execute(T P) {
         assert(P);
+        _bind(P);
+        if (P->lastError != SQLITE_OK)
+                THROW(SQLException, "%s", sqlite3_errmsg(P->db));
         P->lastError = zdb_sqlite3_step(P->stmt);
         switch (P->lastError) {
                 case SQLITE_DONE:
@@ -155,6 +177,7 @@ static void _execute(T P) {
 
 static ResultSet_T _executeQuery(T P) {
         assert(P);
+        _bind(P);
         if (P->lastError == SQLITE_OK)
                 return ResultSet_new(SQLiteResultSet_new(P->delegator, P->stmt, true), (Rop_T)&sqlite3rops);
         THROW(SQLException, "%s", sqlite3_errmsg(P->db));
@@ -170,7 +193,58 @@ static long long _rowsChanged(T P) {
 
 static int _parameterCount(T P) {
         assert(P);
-        return sqlite3_bind_parameter_count(P->stmt);
+        return P->parameterCount;
+}
+
+
+static void _clear(T P) {
+        assert(P);
+        sqlite3_reset(P->stmt);
+        sqlite3_clear_bindings(P->stmt);
+        if (P->params)
+                memset(P->params, 0, P->parameterCount * sizeof(Param_T));
+        P->lastError = SQLITE_OK;
+}
+
+
+/* Run the batch in one transaction, unless the caller has one open, so SQLite does not commit and sync each row */
+static bool _executeBatch(T P, int rows, Param_T **params, long long *rowsChanged, char **errors) {
+        assert(P);
+        bool implicit = sqlite3_get_autocommit(P->db);
+        if (implicit && zdb_sqlite3_exec(P->db, "BEGIN TRANSACTION;") != SQLITE_OK)
+                return false;
+        for (int i = 0; i < rows; i++) {
+                if (P->parameterCount > 0)
+                        memcpy(P->params, params[i], P->parameterCount * sizeof(Param_T));
+                _bind(P);
+                if (P->lastError == SQLITE_OK)
+                        P->lastError = zdb_sqlite3_step(P->stmt);
+                if (P->lastError == SQLITE_DONE) {
+                        rowsChanged[i] = sqlite3_changes(P->db);
+                } else {
+                        rowsChanged[i] = -1;
+                        errors[i] = Str_dup(P->lastError == SQLITE_ROW ? "Select statement not allowed in a batch" : sqlite3_errmsg(P->db));
+                }
+        }
+        _clear(P);
+        if (implicit && zdb_sqlite3_exec(P->db, "COMMIT TRANSACTION;") != SQLITE_OK) {
+                const char *error = sqlite3_errmsg(P->db);
+                for (int i = 0; i < rows; i++) {
+                        if (! errors[i]) {
+                                rowsChanged[i] = -1;
+                                errors[i] = Str_dup(error);
+                        }
+                }
+                zdb_sqlite3_exec(P->db, "ROLLBACK TRANSACTION;");
+        }
+        return true;
+}
+
+
+static void _getParameters(T P, Param_T *row) {
+        assert(P);
+        if (P->parameterCount > 0)
+                memcpy(row, P->params, P->parameterCount * sizeof(Param_T));
 }
 
 
@@ -189,7 +263,10 @@ const struct Pop_T sqlite3pops = {
         .execute        = _execute,
         .executeQuery   = _executeQuery,
         .rowsChanged    = _rowsChanged,
-        .parameterCount = _parameterCount
+        .parameterCount = _parameterCount,
+        .clear          = _clear,
+        .executeBatch   = _executeBatch,
+        .getParameters  = _getParameters
 };
 
 
@@ -29,6 +29,9 @@
 #include <errno.h>
 #include <string.h>
 #include <stdlib.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/socket.h>
 
 #include "Str.h"
 #include "system/Time.h"
@@ -67,6 +70,28 @@ const char *System_getError(int error) {
 }
 
 
+int System_getCPUs(void) {
+        long n = sysconf(_SC_NPROCESSORS_ONLN);
+        return (n > 0) ? (int)n : 1;
+}
+
+
+bool System_isSocketAlive(int socket) {
+        char c;
+        struct pollfd fds = {.fd = socket, .events = POLLIN};
+        if (socket < 0)
+                return false;
+        int r = poll(&fds, 1, 0);
+        if (r == 0)
+                return true;
+        if (r < 0 || (fds.revents & (POLLERR | POLLHUP | POLLNVAL)))
+                return false;
+        // Readable while idle. Peek to tell end-of-file from pending data, both are suspicious
+        ssize_t n = recv(socket, &c, 1, MSG_PEEK | MSG_DONTWAIT);
+        return (n < 0) && (errno == EAGAIN || errno == EWOULDBLOCK);
+}
+
+
 void System_abort(const char *e, ...) {
         va_list ap;
         va_start(ap, e);
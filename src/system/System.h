@@ -56,6 +56,24 @@ const char *System_getLastError(void);
 const char *System_getError(int error);
 
 
+/**
+ * Returns the number of online processors
+ * @return The number of processors available or 1 if unknown
+ */
+int System_getCPUs(void);
+
+
+/**
+ * Test, without blocking and without sending anything, if a connected socket
+ * looks alive. The socket is polled for hang-up, error or end-of-file. Data
+ * pending on an idle database connection is also reported as suspicious.
+ * @param socket A connected socket descriptor
+ * @return true if the socket looks alive, false if it is closed, in error
+ * or has unexpected data pending
+ */
+bool System_isSocketAlive(int socket);
+
+
 /**
  * Prints the given error message to <code>stderr</code> and 
  * <code>abort(3)</code> the application. If an AbortHandler callback 
@@ -63,7 +63,8 @@ static inline void _append(T S, const char *s, va_list ap) {
                         S->used += n;
                         break;
                 }
-                S->length += STRLEN + n;
+                // Grow geometrically so a long sequence of appends is amortized O(n)
+                S->length = S->length * 2 > S->used + n + 1 ? S->length * 2 : S->used + n + 1;
                 RESIZE(S->buffer, S->length);
         }
 }
@@ -50,6 +50,7 @@ extern "C" {
 #include <PreparedStatement.h>
 #include <Connection.h>
 #include <ConnectionPool.h>
+#include <ShardRouter.h>
 
 #ifdef __cplusplus
 }
@@ -26,6 +26,8 @@
 
 #include "zdb.h"
 #include <string>
+#include <cstring>
+#include <list>
 #include <utility>
 #include <stdexcept>
 
@@ -294,6 +296,26 @@ namespace zdb {
             return PreparedStatement_rowsChanged(t_);
         }
         
+        void addBatch() {
+            PreparedStatement_addBatch(t_);
+        }
+        
+        int getBatchSize() {
+            return PreparedStatement_getBatchSize(t_);
+        }
+        
+        long long executeBatch() {
+            except_wrapper( RETURN PreparedStatement_executeBatch(t_) );
+        }
+        
+        long long getBatchRowsChanged(int row) {
+            except_wrapper( RETURN PreparedStatement_getBatchRowsChanged(t_, row) );
+        }
+        
+        const char *getBatchError(int row) {
+            except_wrapper( RETURN PreparedStatement_getBatchError(t_, row) );
+        }
+        
         int getParameterCount() {
             return PreparedStatement_getParameterCount(t_);
         }
@@ -348,6 +370,7 @@ namespace zdb {
         
     protected:  // for ConnectionPool
         friend class ConnectionPool;
+        friend class ShardRouter;
         
         Connection(Connection_T C)
         :t_(C)
@@ -422,7 +445,11 @@ namespace zdb {
         }
         
         void execute(const char *sql) {
-            except_wrapper( Connection_execute(t_, "%s", sql) );
+            except_wrapper( Connection_execute_n(t_, sql, strlen(sql)) );
+        }
+        
+        void execute(const std::string& sql) {
+            except_wrapper( Connection_execute_n(t_, sql.data(), sql.size()) );
         }
         
         template <typename ...Args>
@@ -433,7 +460,14 @@ namespace zdb {
         
         ResultSet executeQuery(const char *sql) {
             except_wrapper(
-                           ResultSet_T r = Connection_executeQuery(t_, "%s", sql);
+                           ResultSet_T r = Connection_executeQuery_n(t_, sql, strlen(sql));
+                           RETURN ResultSet(r);
+                           );
+        }
+        
+        ResultSet executeQuery(const std::string& sql) {
+            except_wrapper(
+                           ResultSet_T r = Connection_executeQuery_n(t_, sql.data(), sql.size());
                            RETURN ResultSet(r);
                            );
         }
@@ -446,7 +480,14 @@ namespace zdb {
         
         PreparedStatement prepareStatement(const char *sql) {
             except_wrapper(
-                           PreparedStatement_T p = Connection_prepareStatement(t_, "%s", sql);
+                           PreparedStatement_T p = Connection_prepareStatement_n(t_, sql, strlen(sql));
+                           RETURN PreparedStatement(p);
+                           );
+        }
+        
+        PreparedStatement prepareStatement(const std::string& sql) {
+            except_wrapper(
+                           PreparedStatement_T p = Connection_prepareStatement_n(t_, sql.data(), sql.size());
                            RETURN PreparedStatement(p);
                            );
         }
@@ -461,6 +502,13 @@ namespace zdb {
                            );
         }
         
+        PreparedStatement getStatement(int handle) {
+            except_wrapper(
+                           PreparedStatement_T p = Connection_getStatement(t_, handle);
+                           RETURN PreparedStatement(p);
+                           );
+        }
+        
         const char *getLastError() {
             return Connection_getLastError(t_);
         }
@@ -526,6 +574,22 @@ namespace zdb {
             return ConnectionPool_getConnectionTimeout(t_);
         }
         
+        void setValidation(Validation_T validation) {
+            ConnectionPool_setValidation(t_, validation);
+        }
+        
+        Validation_T getValidation() {
+            return ConnectionPool_getValidation(t_);
+        }
+        
+        void setValidationWindow(int ms) {
+            ConnectionPool_setValidationWindow(t_, ms);
+        }
+        
+        int getValidationWindow() {
+            return ConnectionPool_getValidationWindow(t_);
+        }
+        
         void setAbortHandler(void(*abortHandler)(const char *error)) {
             ConnectionPool_setAbortHandler(t_, abortHandler);
         }
@@ -534,14 +598,142 @@ namespace zdb {
             ConnectionPool_setReaper(t_, sweepInterval);
         }
         
+        void setMinIdle(int minIdle) {
+            ConnectionPool_setMinIdle(t_, minIdle);
+        }
+        
+        int getMinIdle() {
+            return ConnectionPool_getMinIdle(t_);
+        }
+        
+        void setShards(int shards) {
+            ConnectionPool_setShards(t_, shards);
+        }
+        
+        int getShards() {
+            return ConnectionPool_getShards(t_);
+        }
+        
+        void setMaxLifetime(int maxLifetime) {
+            ConnectionPool_setMaxLifetime(t_, maxLifetime);
+        }
+        
+        int getMaxLifetime() {
+            return ConnectionPool_getMaxLifetime(t_);
+        }
+        
+        void setReserved(int reserved) {
+            ConnectionPool_setReserved(t_, reserved);
+        }
+        
+        int getReserved() {
+            return ConnectionPool_getReserved(t_);
+        }
+        
+        void setAdaptiveSizing(bool adaptive) {
+            ConnectionPool_setAdaptiveSizing(t_, adaptive);
+        }
+        
+        bool getAdaptiveSizing() {
+            return ConnectionPool_getAdaptiveSizing(t_);
+        }
+        
+        int getTargetSize() {
+            return ConnectionPool_getTargetSize(t_);
+        }
+        
+        void setThreadAffinity(bool affinity) {
+            ConnectionPool_setThreadAffinity(t_, affinity);
+        }
+        
+        bool getThreadAffinity() {
+            return ConnectionPool_getThreadAffinity(t_);
+        }
+        
+        void setCircuitBreaker(int failures, int backoff) {
+            ConnectionPool_setCircuitBreaker(t_, failures, backoff);
+        }
+        
+        CircuitBreaker_T getCircuitBreaker() {
+            return ConnectionPool_getCircuitBreaker(t_);
+        }
+        
+        void setStatementCacheSize(int size) {
+            ConnectionPool_setStatementCacheSize(t_, size);
+        }
+        
+        int getStatementCacheSize() {
+            return ConnectionPool_getStatementCacheSize(t_);
+        }
+        
+        int registerStatement(const std::string& sql) {
+            return ConnectionPool_registerStatement(t_, sql.c_str());
+        }
+        
+        int prepared(int handle) {
+            return ConnectionPool_prepared(t_, handle);
+        }
+        
+        int addTenant(const std::string& name, int maxActive, int minimum = 0) {
+            return ConnectionPool_addTenant(t_, name.c_str(), maxActive, minimum);
+        }
+        
+        int getTenant(const std::string& name) {
+            return ConnectionPool_getTenant(t_, name.c_str());
+        }
+        
+        TenantStatistics_T getTenantStatistics(int tenant) {
+            TenantStatistics_T statistics;
+            ConnectionPool_getTenantStatistics(t_, tenant, &statistics);
+            return statistics;
+        }
+        
+        void addReplica(const std::string& url) {
+            addReplica(url.c_str());
+        }
+        
+        void addReplica(const char *url) {
+            URL& replica = replicas_.emplace_back(url);
+            if (!replica) {
+                replicas_.pop_back();
+                throw sql_exception("Invalid URL");
+            }
+            ConnectionPool_addReplica(t_, replica);
+        }
+        
+        int getReplicas() {
+            return ConnectionPool_getReplicas(t_);
+        }
+        
         int size() {
             return ConnectionPool_size(t_);
         }
         
+        std::string renderMetrics(const char *name = nullptr) {
+            int n = ConnectionPool_renderMetrics(t_, name, nullptr, 0);
+            std::string metrics(n, '\0');
+            ConnectionPool_renderMetrics(t_, name, metrics.data(), n + 1);
+            return metrics;
+        }
+        
+        PoolStatistics_T getStatistics() {
+            PoolStatistics_T statistics;
+            ConnectionPool_getStatistics(t_, &statistics);
+            return statistics;
+        }
+        
         int active() {
             return ConnectionPool_active(t_);
         }
         
+        int waiting() {
+            return ConnectionPool_waiting(t_);
+        }
+        
+        long long waitTime() {
+            return ConnectionPool_waitTime(t_);
+        }
+        
         void start() {
             except_wrapper( ConnectionPool_start(t_) );
         }
@@ -558,6 +750,38 @@ namespace zdb {
             return Connection(C);
         }
         
+        Connection getConnection(int ms) {
+            Connection_T C = ConnectionPool_getConnectionWithTimeout(t_, ms);
+            if (!C) {
+                throw sql_exception("timed out waiting for a connection (got null connection)!");
+            }
+            return Connection(C);
+        }
+        
+        Connection getConnection(Priority_T priority, int ms) {
+            Connection_T C = ConnectionPool_getConnectionWithPriority(t_, priority, ms);
+            if (!C) {
+                throw sql_exception("timed out waiting for a connection (got null connection)!");
+            }
+            return Connection(C);
+        }
+        
+        Connection getConnectionForTenant(int tenant, int ms = 0) {
+            Connection_T C = ConnectionPool_getConnectionForTenant(t_, tenant, ms);
+            if (!C) {
+                throw sql_exception("tenant quota or maxConnection is reached (got null connection)!");
+            }
+            return Connection(C);
+        }
+        
+        Connection getReadConnection() {
+            Connection_T C = ConnectionPool_getReadConnection(t_);
+            if (!C) {
+                throw sql_exception("maxConnection is reached (got null connection)!");
+            }
+            return Connection(C);
+        }
+        
         void returnConnection(Connection& con) {
             con.close();
         }
@@ -572,10 +796,88 @@ namespace zdb {
         
     private:
         URL url_;
+        std::list<URL> replicas_;
         ConnectionPool_T t_;
     };
     
     
+    class ShardRouter : private noncopyable
+    {
+    public:
+        ShardRouter() {
+            t_ = ShardRouter_new();
+        }
+        
+        ~ShardRouter() {
+            ShardRouter_free(&t_);
+        }
+        
+        operator ShardRouter_T() {
+            return t_;
+        }
+        
+    public:
+        ConnectionPool_T addShard(const std::string& url) {
+            return addShard(url.c_str());
+        }
+        
+        ConnectionPool_T addShard(const char *url) {
+            URL& shard = urls_.emplace_back(url);
+            if (!shard) {
+                urls_.pop_back();
+                throw sql_exception("Invalid URL");
+            }
+            return ShardRouter_addShard(t_, shard);
+        }
+        
+        int size() {
+            return ShardRouter_size(t_);
+        }
+        
+        ConnectionPool_T getPool(int shard) {
+            return ShardRouter_getPool(t_, shard);
+        }
+        
+        void start() {
+            except_wrapper( ShardRouter_start(t_) );
+        }
+        
+        void stop() {
+            ShardRouter_stop(t_);
+        }
+        
+        int getShard(const std::string& key) {
+            return ShardRouter_getShard(t_, key.c_str());
+        }
+        
+        Connection getConnection(const std::string& key) {
+            Connection_T C = ShardRouter_getConnection(t_, key.c_str());
+            if (!C) {
+                throw sql_exception("maxConnection is reached (got null connection)!");
+            }
+            return Connection(C);
+        }
+        
+        Connection getConnection(const std::string& key, int ms) {
+            Connection_T C = ShardRouter_getConnectionWithTimeout(t_, key.c_str(), ms);
+            if (!C) {
+                throw sql_exception("timed out waiting for a connection (got null connection)!");
+            }
+            return Connection(C);
+        }
+        
+        PoolStatistics_T getStatistics(int shard) {
+            PoolStatistics_T statistics;
+            ShardRouter_getStatistics(t_, shard, &statistics);
+            return statistics;
+        }
+        
+    private:
+        std::list<URL> urls_;
+        ShardRouter_T t_;
+    };
+    
+    
 } // namespace
 
 #endif
@@ -5,6 +5,7 @@
 #include <assert.h>
 #include <unistd.h>
 #include <stdlib.h>
+#include <sys/stat.h>
 
 #include "URL.h"
 #include "Thread.h"
@@ -13,6 +14,7 @@
 #include "PreparedStatement.h"
 #include "Connection.h"
 #include "ConnectionPool.h"
+#include "ShardRouter.h"
 #include "AssertException.h"
 #include "SQLException.h"
 
@@ -39,6 +41,40 @@ static void TabortHandler(const char *error) {
         exit(1);
 }
 
+static void *returnConnectionLater(void *con) {
+        usleep(200000);
+        Connection_close(con);
+        return NULL;
+}
+
+typedef struct {
+        ConnectionPool_T pool;
+        Connection_T connection;
+} checkout_t;
+
+static void *getConnectionWithTimeout(void *args) {
+        checkout_t *c = args;
+        c->connection = ConnectionPool_getConnectionWithTimeout(c->pool, 5000);
+        return NULL;
+}
+
+static void *checkoutAndReturn(void *args) {
+        ConnectionPool_T pool = args;
+        for (int i = 0; i < 500; i++) {
+                Connection_T con = ConnectionPool_getConnectionWithTimeout(pool, 5000);
+                assert(con);
+                Connection_close(con);
+        }
+        return NULL;
+}
+
+/* Return the query timeout the database session has, in milliseconds */
+static int getSessionTimeout(Connection_T con, bool sqlite) {
+        ResultSet_T r = Connection_executeQuery(con, sqlite ? "pragma busy_timeout;" : "select setting::int from pg_settings where name = 'statement_timeout';");
+        assert(ResultSet_next(r));
+        return ResultSet_getInt(r, 1);
+}
+
 static void testPool(const char *testURL) {
         URL_T url;
         char *schema;
@@ -700,6 +736,930 @@ static void testPool(const char *testURL) {
         }
         printf("=> Test10: OK\n\n");
 
+        printf("=> Test11: Wait for a connection when the pool is exhausted\n");
+        {
+                Thread_T thread;
+                url = URL_new(testURL);
+                pool = ConnectionPool_new(url);
+                assert(pool);
+                ConnectionPool_setInitialConnections(pool, 2);
+                ConnectionPool_setMaxConnections(pool, 2);
+                ConnectionPool_start(pool);
+                Connection_T con1 = ConnectionPool_getConnection(pool);
+                Connection_T con2 = ConnectionPool_getConnection(pool);
+                assert(con1 && con2);
+                assert(! ConnectionPool_getConnection(pool));
+                assert(! ConnectionPool_getConnectionWithTimeout(pool, 100));
+                assert(ConnectionPool_waiting(pool) == 0);
+                Thread_create(thread, returnConnectionLater, con2);
+                Connection_T con = ConnectionPool_getConnectionWithTimeout(pool, 5000);
+                assert(con == con2);
+                Thread_join(thread);
+                assert(ConnectionPool_active(pool) == 2);
+                Connection_close(con1);
+                Connection_close(con);
+                ConnectionPool_stop(pool);
+                ConnectionPool_free(&pool);
+                assert(pool==NULL);
+                URL_free(&url);
+        }
+        printf("=> Test11: OK\n\n");
+
+        printf("=> Test12: Minimum idle connections\n");
+        {
+                url = URL_new(testURL);
+                pool = ConnectionPool_new(url);
+                assert(pool);
+                ConnectionPool_setInitialConnections(pool, 1);
+                ConnectionPool_setMinIdle(pool, 3);
+                ConnectionPool_start(pool);
+                for (int i = 0; i < 50 && ConnectionPool_size(pool) < 3; i++)
+                        usleep(100000);
+                assert(ConnectionPool_size(pool) == 3);
+                Connection_T con = ConnectionPool_getConnection(pool);
+                assert(con);
+                for (int i = 0; i < 50 && ConnectionPool_size(pool) < 4; i++)
+                        usleep(100000);
+                assert(ConnectionPool_size(pool) == 4); // One active and 3 idle
+                Connection_close(con);
+                ConnectionPool_stop(pool);
+                ConnectionPool_free(&pool);
+                assert(pool==NULL);
+                URL_free(&url);
+        }
+        printf("=> Test12: OK\n\n");
+
+        printf("=> Test13: Sharded pool\n");
+        {
+                Connection_T cons[8];
+                url = URL_new(testURL);
+                pool = ConnectionPool_new(url);
+                assert(pool);
+                ConnectionPool_setShards(pool, 4);
+                assert(ConnectionPool_getShards(pool) == 4);
+                ConnectionPool_setInitialConnections(pool, 4);
+                ConnectionPool_setMaxConnections(pool, 8);
+                ConnectionPool_start(pool);
+                assert(ConnectionPool_size(pool) == 4);
+                // Idle connections are stolen from other shards before new connections are created
+                for (int i = 0; i < 8; i++) {
+                        cons[i] = ConnectionPool_getConnection(pool);
+                        assert(cons[i]);
+                }
+                assert(ConnectionPool_size(pool) == 8);
+                assert(ConnectionPool_active(pool) == 8);
+                assert(! ConnectionPool_getConnection(pool));
+                for (int i = 0; i < 8; i++)
+                        Connection_close(cons[i]);
+                assert(ConnectionPool_active(pool) == 0);
+                ConnectionPool_stop(pool);
+                ConnectionPool_free(&pool);
+                assert(pool==NULL);
+                URL_free(&url);
+        }
+        printf("=> Test13: OK\n\n");
+
+        printf("=> Test14: Thread affinity\n");
+        {
+                url = URL_new(testURL);
+                pool = ConnectionPool_new(url);
+                assert(pool);
+                ConnectionPool_setThreadAffinity(pool, true);
+                assert(ConnectionPool_getThreadAffinity(pool));
+                ConnectionPool_setInitialConnections(pool, 2);
+                ConnectionPool_setMaxConnections(pool, 2);
+                ConnectionPool_start(pool);
+                Connection_T con1 = ConnectionPool_getConnection(pool);
+                assert(con1);
+                Connection_close(con1);
+                assert(ConnectionPool_active(pool) == 0);
+                // The parked connection is handed back to this thread
+                for (int i = 0; i < 10; i++) {
+                        Connection_T con = ConnectionPool_getConnection(pool);
+                        assert(con == con1);
+                        Connection_close(con);
+                }
+                // Parked connections are reclaimed when the pool runs short
+                Connection_T con2 = ConnectionPool_getConnection(pool);
+                Connection_T con3 = ConnectionPool_getConnection(pool);
+                assert(con2 && con3 && con2 != con3);
+                assert(! ConnectionPool_getConnection(pool));
+                assert(ConnectionPool_active(pool) == 2);
+                Connection_close(con2);
+                Connection_close(con3);
+                assert(ConnectionPool_active(pool) == 0);
+                assert(ConnectionPool_size(pool) == 2);
+                ConnectionPool_stop(pool);
+                ConnectionPool_free(&pool);
+                assert(pool==NULL);
+                URL_free(&url);
+        }
+        printf("=> Test14: OK\n\n");
+
+        printf("=> Test15: Reap without blocking checkouts\n");
+        {
+                url = URL_new(testURL);
+                pool = ConnectionPool_new(url);
+                assert(pool);
+                ConnectionPool_setInitialConnections(pool, 4);
+                ConnectionPool_setValidation(pool, Validation_background);
+                ConnectionPool_start(pool);
+                Connection_T con = ConnectionPool_getConnection(pool);
+                assert(con);
+                // Idle connections are pinged outside the pool lock and put back
+                assert(ConnectionPool_reapConnections(pool) == 0);
+                assert(ConnectionPool_size(pool) == 4);
+                assert(ConnectionPool_active(pool) == 1);
+                Connection_close(con);
+                assert(ConnectionPool_active(pool) == 0);
+                // Survivors keep their LRU position, the most recently returned is handed out first
+                Connection_T a = ConnectionPool_getConnection(pool);
+                Connection_T b = ConnectionPool_getConnection(pool);
+                Connection_close(a);
+                Connection_close(b);
+                assert(ConnectionPool_reapConnections(pool) == 0);
+                con = ConnectionPool_getConnection(pool);
+                assert(con == b);
+                Connection_close(con);
+                ConnectionPool_stop(pool);
+                ConnectionPool_free(&pool);
+                assert(pool==NULL);
+                URL_free(&url);
+        }
+        printf("=> Test15: OK\n\n");
+
+        printf("=> Test16: Max lifetime\n");
+        {
+                url = URL_new(testURL);
+                pool = ConnectionPool_new(url);
+                assert(pool);
+                ConnectionPool_setInitialConnections(pool, 2);
+                ConnectionPool_setMaxLifetime(pool, 2);
+                assert(ConnectionPool_getMaxLifetime(pool) == 2);
+                ConnectionPool_start(pool);
+                Connection_T con = ConnectionPool_getConnection(pool);
+                assert(con);
+                printf("Please wait 3 sec for connections to be recycled..");
+                fflush(stdout);
+                sleep(3);
+                // The expired connection is closed on return and replaced in the background
+                Connection_close(con);
+                for (int i = 0; i < 50 && ConnectionPool_size(pool) < 2; i++)
+                        usleep(100000);
+                assert(ConnectionPool_size(pool) == 2);
+                assert(ConnectionPool_active(pool) == 0);
+                con = ConnectionPool_getConnection(pool);
+                assert(con);
+                assert(Connection_ping(con));
+                Connection_close(con);
+                printf("success\n");
+                ConnectionPool_stop(pool);
+                ConnectionPool_free(&pool);
+                assert(pool==NULL);
+                URL_free(&url);
+        }
+        printf("=> Test16: OK\n\n");
+
+        printf("=> Test17: Adaptive sizing\n");
+        {
+                Connection_T cons[4];
+                url = URL_new(testURL);
+                pool = ConnectionPool_new(url);
+                assert(pool);
+                ConnectionPool_setInitialConnections(pool, 1);
+                ConnectionPool_setMaxConnections(pool, 10);
+                ConnectionPool_setAdaptiveSizing(pool, true);
+                assert(ConnectionPool_getAdaptiveSizing(pool));
+                ConnectionPool_start(pool);
+                assert(ConnectionPool_getTargetSize(pool) == 1);
+                for (int i = 0; i < 4; i++) {
+                        cons[i] = ConnectionPool_getConnection(pool);
+                        assert(cons[i]);
+                }
+                printf("Please wait 6 sec for the sizing controller..");
+                fflush(stdout);
+                sleep(SQL_DEFAULT_ADAPT_INTERVAL + 1);
+                // The target covers at least the peak number of active connections
+                assert(ConnectionPool_getTargetSize(pool) >= 4);
+                assert(ConnectionPool_getTargetSize(pool) <= 10);
+                assert(ConnectionPool_size(pool) >= 4);
+                printf("success\n");
+                for (int i = 0; i < 4; i++)
+                        Connection_close(cons[i]);
+                ConnectionPool_stop(pool);
+                ConnectionPool_free(&pool);
+                assert(pool==NULL);
+                URL_free(&url);
+        }
+        printf("=> Test17: OK\n\n");
+
+        printf("=> Test18: Priority classes and reserved connections\n");
+        {
+                Thread_T thread;
+                url = URL_new(testURL);
+                pool = ConnectionPool_new(url);
+                assert(pool);
+                ConnectionPool_setInitialConnections(pool, 3);
+                ConnectionPool_setMaxConnections(pool, 3);
+                ConnectionPool_setReserved(pool, 1);
+                assert(ConnectionPool_getReserved(pool) == 1);
+                ConnectionPool_start(pool);
+                Connection_T con1 = ConnectionPool_getConnection(pool);
+                Connection_T con2 = ConnectionPool_getConnection(pool);
+                assert(con1 && con2);
+                // The last connection is reserved for high priority callers
+                assert(! ConnectionPool_getConnection(pool));
+                assert(! ConnectionPool_getConnectionWithTimeout(pool, 100));
+                Connection_T con3 = ConnectionPool_getConnectionWithPriority(pool, Priority_high, 0);
+                assert(con3);
+                // A connection returned is handed to a waiting high priority caller
+                Thread_create(thread, returnConnectionLater, con2);
+                Connection_T con4 = ConnectionPool_getConnectionWithPriority(pool, Priority_high, 5000);
+                assert(con4 == con2);
+                Thread_join(thread);
+                Connection_close(con4);
+                // Normal priority callers got their quota back
+                con2 = ConnectionPool_getConnectionWithPriority(pool, Priority_normal, 0);
+                assert(con2);
+                assert(ConnectionPool_active(pool) == 3);
+                Connection_close(con1);
+                Connection_close(con2);
+                Connection_close(con3);
+                assert(ConnectionPool_active(pool) == 0);
+                ConnectionPool_stop(pool);
+                ConnectionPool_free(&pool);
+                assert(pool==NULL);
+                URL_free(&url);
+        }
+        printf("=> Test18: OK\n\n");
+
+        printf("=> Test19: Statistics\n");
+        {
+                PoolStatistics_T s;
+                url = URL_new(testURL);
+                pool = ConnectionPool_new(url);
+                assert(pool);
+                ConnectionPool_setInitialConnections(pool, 2);
+                ConnectionPool_setMaxConnections(pool, 3);
+                ConnectionPool_start(pool);
+                Connection_T con1 = ConnectionPool_getConnection(pool);
+                Connection_T con2 = ConnectionPool_getConnection(pool);
+                Connection_T con3 = ConnectionPool_getConnection(pool);
+                assert(con1 && con2 && con3);
+                Connection_close(con1);
+                ConnectionPool_getStatistics(pool, &s);
+                assert(s.checkouts == 3);
+                assert(s.returns == 1);
+                assert(s.creations == 3);
+                assert(s.creationFailures == 0);
+                assert(s.peakActive == 3);
+                assert(s.size == 3);
+                assert(s.active == 2);
+                assert(s.maxConnections == 3);
+                assert(s.checkoutWait.count == 3);
+                assert(s.holdTime.count == 1);
+                assert(s.connectTime.count == 3);
+                long long n = 0;
+                for (int i = 0; i < SQL_HISTOGRAM_BUCKETS; i++)
+                        n += s.checkoutWait.buckets[i];
+                assert(n == 3);
+                // Hold time has microsecond resolution
+                long long sum = s.holdTime.sum, zero = s.holdTime.buckets[0];
+                con1 = ConnectionPool_getConnection(pool);
+                usleep(200);
+                Connection_close(con1);
+                ConnectionPool_getStatistics(pool, &s);
+                assert(s.holdTime.count == 2);
+                assert(s.holdTime.buckets[0] == zero);
+                assert(s.holdTime.sum - sum >= 200);
+                Connection_close(con2);
+                Connection_close(con3);
+                ConnectionPool_stop(pool);
+                ConnectionPool_free(&pool);
+                assert(pool==NULL);
+                URL_free(&url);
+        }
+        printf("=> Test19: OK\n\n");
+
+        printf("=> Test20: OpenMetrics\n");
+        {
+                char buffer[8192];
+                url = URL_new(testURL);
+                pool = ConnectionPool_new(url);
+                assert(pool);
+                ConnectionPool_start(pool);
+                Connection_T con = ConnectionPool_getConnection(pool);
+                assert(con);
+                int n = ConnectionPool_renderMetrics(pool, "test\"pool", buffer, sizeof(buffer));
+                assert(n > 0 && n < sizeof(buffer));
+                assert(n == strlen(buffer));
+                assert(strstr(buffer, "zdb_pool_active_connections{pool=\"test\\\"pool\"} 1\n"));
+                assert(strstr(buffer, "zdb_pool_checkouts_total{pool=\"test\\\"pool\"} 1\n"));
+                assert(strstr(buffer, "zdb_pool_checkout_wait_seconds_count{pool=\"test\\\"pool\"} 1\n"));
+                assert(Str_isEqual(buffer + n - 6, "# EOF\n"));
+                // Truncated output
+                int m = ConnectionPool_renderMetrics(pool, NULL, buffer, 64);
+                assert(m > 64);
+                assert(strlen(buffer) == 63);
+                assert(strstr(buffer, "# TYPE zdb_pool_connections gauge\n"));
+                Connection_close(con);
+                ConnectionPool_stop(pool);
+                ConnectionPool_free(&pool);
+                assert(pool==NULL);
+                URL_free(&url);
+        }
+        printf("=> Test20: OK\n\n");
+
+        printf("=> Test21: Read replicas\n");
+        {
+                url = URL_new(testURL);
+                URL_T replica = URL_new(testURL);
+                pool = ConnectionPool_new(url);
+                assert(pool);
+                ConnectionPool_setInitialConnections(pool, 1);
+                ConnectionPool_setMaxConnections(pool, 1);
+                ConnectionPool_addReplica(pool, replica);
+                assert(ConnectionPool_getReplicas(pool) == 1);
+                ConnectionPool_start(pool);
+                // Read connections are taken from the replica
+                Connection_T r = ConnectionPool_getReadConnection(pool);
+                assert(r);
+                assert(ConnectionPool_active(pool) == 0);
+                // The replica is exhausted, fall back to the primary
+                Connection_T p = ConnectionPool_getReadConnection(pool);
+                assert(p);
+                assert(ConnectionPool_active(pool) == 1);
+                assert(! ConnectionPool_getReadConnection(pool));
+                Connection_close(p);
+                Connection_close(r);
+                r = ConnectionPool_getReadConnection(pool);
+                assert(r);
+                assert(ConnectionPool_active(pool) == 0);
+                Connection_close(r);
+                ConnectionPool_free(&pool);
+                assert(pool==NULL);
+                URL_free(&replica);
+                URL_free(&url);
+        }
+        printf("=> Test21: OK\n\n");
+
+        printf("=> Test22: Circuit breaker\n");
+        if (Str_startsWith(testURL, "sqlite")) {
+                // The database is unreachable until its directory is created
+                rmdir("/tmp/zild_breaker");
+                url = URL_new("sqlite:///tmp/zild_breaker/zild.db");
+                pool = ConnectionPool_new(url);
+                assert(pool);
+                ConnectionPool_setInitialConnections(pool, 0);
+                ConnectionPool_setCircuitBreaker(pool, 2, 300);
+                ConnectionPool_start(pool);
+                assert(ConnectionPool_getCircuitBreaker(pool) == CircuitBreaker_closed);
+                assert(! ConnectionPool_getConnection(pool));
+                assert(ConnectionPool_getCircuitBreaker(pool) == CircuitBreaker_closed);
+                assert(! ConnectionPool_getConnection(pool));
+                assert(ConnectionPool_getCircuitBreaker(pool) == CircuitBreaker_open);
+                // Fail fast instead of waiting for the timeout
+                long long start = Time_milli();
+                assert(! ConnectionPool_getConnectionWithTimeout(pool, 5000));
+                assert(Time_milli() - start < 1000);
+                // After the back-off a probe is let through and closes the breaker
+                mkdir("/tmp/zild_breaker", 0700);
+                Time_usleep(400000);
+                assert(ConnectionPool_getCircuitBreaker(pool) == CircuitBreaker_halfOpen);
+                Connection_T con = ConnectionPool_getConnection(pool);
+                assert(con);
+                assert(ConnectionPool_getCircuitBreaker(pool) == CircuitBreaker_closed);
+                Connection_close(con);
+                ConnectionPool_free(&pool);
+                assert(pool==NULL);
+                // Callers arriving while the probe connects sleep until it closes the breaker
+                unlink("/tmp/zild_breaker/zild.db");
+                rmdir("/tmp/zild_breaker");
+                PoolStatistics_T s;
+                Thread_T threads[4];
+                checkout_t checkouts[4];
+                pool = ConnectionPool_new(url);
+                ConnectionPool_setInitialConnections(pool, 0);
+                ConnectionPool_setMaxConnections(pool, 4);
+                ConnectionPool_setCircuitBreaker(pool, 1, 300);
+                ConnectionPool_start(pool);
+                assert(! ConnectionPool_getConnection(pool));
+                assert(ConnectionPool_getCircuitBreaker(pool) == CircuitBreaker_open);
+                mkdir("/tmp/zild_breaker", 0700);
+                Time_usleep(400000);
+                assert(ConnectionPool_getCircuitBreaker(pool) == CircuitBreaker_halfOpen);
+                start = Time_milli();
+                for (int i = 0; i < 4; i++) {
+                        checkouts[i] = (checkout_t){.pool = pool};
+                        Thread_create(threads[i], getConnectionWithTimeout, &checkouts[i]);
+                }
+                for (int i = 0; i < 4; i++)
+                        Thread_join(threads[i]);
+                // Connections are held until all threads are done, so only the closed breaker could wake a waiter
+                assert(Time_milli() - start < 1000);
+                for (int i = 0; i < 4; i++)
+                        assert(checkouts[i].connection);
+                assert(ConnectionPool_getCircuitBreaker(pool) == CircuitBreaker_closed);
+                ConnectionPool_getStatistics(pool, &s);
+                assert(s.creations == 4 && s.creationFailures == 1);
+                for (int i = 0; i < 4; i++)
+                        Connection_close(checkouts[i].connection);
+                ConnectionPool_free(&pool);
+                assert(pool==NULL);
+                URL_free(&url);
+                unlink("/tmp/zild_breaker/zild.db");
+                rmdir("/tmp/zild_breaker");
+        }
+        printf("=> Test22: OK\n\n");
+
+        printf("=> Test23: Shard router\n");
+        {
+                char key[32];
+                int count[3] = {};
+                url = URL_new(testURL);
+                ShardRouter_T router = ShardRouter_new();
+                for (int i = 0; i < 2; i++) {
+                        pool = ShardRouter_addShard(router, url);
+                        ConnectionPool_setInitialConnections(pool, 1);
+                }
+                assert(ShardRouter_size(router) == 2);
+                ShardRouter_T larger = ShardRouter_new();
+                for (int i = 0; i < 3; i++)
+                        ShardRouter_addShard(larger, url);
+                // Keys are spread evenly and adding a shard only moves keys to the new shard
+                for (int i = 0; i < 3000; i++) {
+                        snprintf(key, sizeof(key), "customer:%d", i);
+                        int shard = ShardRouter_getShard(router, key);
+                        assert(shard == ShardRouter_getShard(router, key));
+                        int moved = ShardRouter_getShard(larger, key);
+                        assert(moved == shard || moved == 2);
+                        count[moved]++;
+                }
+                for (int i = 0; i < 3; i++)
+                        assert(count[i] > 700 && count[i] < 1300);
+                ShardRouter_free(&larger);
+                ShardRouter_start(router);
+                Connection_T con = ShardRouter_getConnection(router, "customer:4711");
+                assert(con);
+                int shard = ShardRouter_getShard(router, "customer:4711");
+                assert(ConnectionPool_active(ShardRouter_getPool(router, shard)) == 1);
+                assert(ConnectionPool_active(ShardRouter_getPool(router, 1 - shard)) == 0);
+                PoolStatistics_T statistics;
+                ShardRouter_getStatistics(router, shard, &statistics);
+                assert(statistics.checkouts == 1);
+                ShardRouter_getStatistics(router, 1 - shard, &statistics);
+                assert(statistics.checkouts == 0);
+                Connection_close(con);
+                ShardRouter_free(&router);
+                assert(router==NULL);
+                if (Str_startsWith(testURL, "sqlite")) {
+                        // Pools started before a shard fails are stopped again
+                        URL_T unreachable = URL_new("sqlite:///tmp/zild_none/zild.db");
+                        router = ShardRouter_new();
+                        pool = ShardRouter_addShard(router, url);
+                        ShardRouter_addShard(router, unreachable);
+                        volatile bool failed = false;
+                        TRY ShardRouter_start(router); ELSE failed = true; END_TRY;
+                        assert(failed);
+                        assert(ConnectionPool_size(pool) == 0);
+                        ShardRouter_free(&router);
+                        URL_free(&unreachable);
+                }
+                URL_free(&url);
+        }
+        printf("=> Test23: OK\n\n");
+
+        printf("=> Test24: Tenant quotas\n");
+        {
+                Connection_T a[2], b[3];
+                TenantStatistics_T statistics;
+                url = URL_new(testURL);
+                pool = ConnectionPool_new(url);
+                assert(pool);
+                ConnectionPool_setInitialConnections(pool, 1);
+                ConnectionPool_setMaxConnections(pool, 4);
+                int A = ConnectionPool_addTenant(pool, "A", 2, 0);
+                int B = ConnectionPool_addTenant(pool, "B", 3, 2);
+                assert(ConnectionPool_getTenant(pool, "B") == B);
+                assert(ConnectionPool_getTenant(pool, "C") == 0);
+                ConnectionPool_start(pool);
+                for (int i = 0; i < 2; i++)
+                        assert((a[i] = ConnectionPool_getConnectionForTenant(pool, A, 0)));
+                // A is at max active and the rest of the pool is guaranteed to B
+                assert(! ConnectionPool_getConnectionForTenant(pool, A, 0));
+                long long start = Time_milli();
+                assert(! ConnectionPool_getConnectionForTenant(pool, A, 200));
+                assert(Time_milli() - start >= 190);
+                assert(! ConnectionPool_getConnection(pool));
+                for (int i = 0; i < 2; i++)
+                        assert((b[i] = ConnectionPool_getConnectionForTenant(pool, B, 0)));
+                assert(! ConnectionPool_getConnectionForTenant(pool, B, 0));
+                // Capacity freed by A is shared
+                Connection_close(a[0]);
+                assert((b[2] = ConnectionPool_getConnectionForTenant(pool, B, 0)));
+                ConnectionPool_getTenantStatistics(pool, B, &statistics);
+                assert(statistics.active == 3);
+                assert(statistics.peakActive == 3);
+                assert(statistics.checkouts == 3);
+                assert(statistics.rejected == 1);
+                ConnectionPool_getTenantStatistics(pool, A, &statistics);
+                assert(statistics.active == 1);
+                assert(statistics.rejected == 2);
+                Connection_close(a[1]);
+                for (int i = 0; i < 3; i++)
+                        Connection_close(b[i]);
+                ConnectionPool_getTenantStatistics(pool, B, &statistics);
+                assert(statistics.active == 0);
+                assert(ConnectionPool_active(pool) == 0);
+                ConnectionPool_free(&pool);
+                assert(pool==NULL);
+                URL_free(&url);
+        }
+        printf("=> Test24: OK\n\n");
+
+        printf("=> Test25: Statement cache\n");
+        {
+                url = URL_new(testURL);
+                pool = ConnectionPool_new(url);
+                assert(pool);
+                ConnectionPool_setInitialConnections(pool, 1);
+                ConnectionPool_setMaxConnections(pool, 1);
+                ConnectionPool_setStatementCacheSize(pool, 2);
+                ConnectionPool_start(pool);
+                Connection_T con = ConnectionPool_getConnection(pool);
+                assert(con);
+                TRY Connection_execute(con, "drop table zild_c;"); ELSE END_TRY;
+                Connection_execute(con, "create table zild_c (id integer);");
+                PreparedStatement_T p = Connection_prepareStatement(con, "insert into zild_c values (%s);", "?");
+                PreparedStatement_setInt(p, 1, 1);
+                PreparedStatement_execute(p);
+                Connection_close(con);
+                // The statement survives the return and its parameter is reset to NULL
+                con = ConnectionPool_getConnection(pool);
+                PreparedStatement_T q = Connection_prepareStatement(con, "insert into zild_c values (?);");
+                assert(q == p);
+                PreparedStatement_execute(q);
+                // A statement is only handed out once per checkout
+                assert(Connection_prepareStatement(con, "insert into zild_c values (?);") != q);
+                ResultSet_T r = Connection_executeQuery(con, "select count(*) from zild_c where id is null;");
+                assert(ResultSet_next(r));
+                assert(ResultSet_getInt(r, 1) == 1);
+                Connection_execute(con, "drop table zild_c;");
+                Connection_close(con);
+                ConnectionPool_free(&pool);
+                assert(pool==NULL);
+                URL_free(&url);
+        }
+        printf("=> Test25: OK\n\n");
+
+        printf("=> Test26: Registered statements\n");
+        {
+                url = URL_new(testURL);
+                pool = ConnectionPool_new(url);
+                assert(pool);
+                ConnectionPool_setInitialConnections(pool, 2);
+                ConnectionPool_setMaxConnections(pool, 2);
+                // A missing table must not fail the pool start
+                int insert = ConnectionPool_registerStatement(pool, "insert into zild_r values (?);");
+                int count = ConnectionPool_registerStatement(pool, "select count(*) from zild_r where id is null;");
+                assert(insert == 1 && count == 2);
+                ConnectionPool_start(pool);
+                Connection_T con = ConnectionPool_getConnection(pool);
+                assert(con);
+                TRY Connection_execute(con, "drop table zild_r;"); ELSE END_TRY;
+                Connection_execute(con, "create table zild_r (id integer);");
+                // Prepared on first use if it could not be prepared up front
+                PreparedStatement_T p = Connection_getStatement(con, insert);
+                PreparedStatement_setInt(p, 1, 1);
+                PreparedStatement_execute(p);
+                assert(Connection_getStatement(con, insert) == p);
+                Connection_close(con);
+                // A connection opened on demand prepares up front
+                ConnectionPool_setMaxConnections(pool, 3);
+                Connection_T a = ConnectionPool_getConnection(pool);
+                Connection_T b = ConnectionPool_getConnection(pool);
+                Connection_T c = ConnectionPool_getConnection(pool);
+                assert(a && b && c);
+                assert(ConnectionPool_prepared(pool, insert) == 2);
+                assert(Connection_getStatement(c, insert));
+                assert(ConnectionPool_prepared(pool, insert) == 2);
+                Connection_close(a);
+                Connection_close(b);
+                Connection_close(c);
+                // Parameters are reset when the connection is returned
+                con = ConnectionPool_getConnection(pool);
+                for (int i = 0; i < 3; i++) {
+                        PreparedStatement_T q = Connection_getStatement(con, insert);
+                        PreparedStatement_execute(q);
+                }
+                ResultSet_T r = PreparedStatement_executeQuery(Connection_getStatement(con, count));
+                assert(ResultSet_next(r));
+                assert(ResultSet_getInt(r, 1) == 3);
+                Connection_close(con);
+                // Connections opened by ConnectionPool_start() prepare up front
+                ConnectionPool_T other = ConnectionPool_new(url);
+                ConnectionPool_setInitialConnections(other, 2);
+                insert = ConnectionPool_registerStatement(other, "insert into zild_r values (?);");
+                ConnectionPool_start(other);
+                assert(ConnectionPool_prepared(other, insert) == 2);
+                ConnectionPool_free(&other);
+                con = ConnectionPool_getConnection(pool);
+                Connection_execute(con, "drop table zild_r;");
+                Connection_close(con);
+                ConnectionPool_free(&pool);
+                assert(pool==NULL);
+                URL_free(&url);
+        }
+        printf("=> Test26: OK\n\n");
+
+        printf("=> Test27: Execute SQL with a length\n");
+        {
+                url = URL_new(testURL);
+                pool = ConnectionPool_new(url);
+                assert(pool);
+                ConnectionPool_setInitialConnections(pool, 1);
+                ConnectionPool_start(pool);
+                Connection_T con = ConnectionPool_getConnection(pool);
+                assert(con);
+                TRY Connection_execute(con, "drop table zild_n;"); ELSE END_TRY;
+                // Only the first len bytes are executed and '%' is not a format specifier
+                const char *sql = "create table zild_n (name varchar(255)); insert into zild_n values ('100%s');garbage";
+                Connection_execute_n(con, sql, strlen(sql) - strlen("garbage"));
+                const char *query = "select name from zild_n where name = '100%s';";
+                ResultSet_T r = Connection_executeQuery_n(con, query, strlen(query));
+                assert(ResultSet_next(r));
+                assert(Str_isEqual(ResultSet_getString(r, 1), "100%s"));
+                PreparedStatement_T p = Connection_prepareStatement_n(con, "select count(*) from zild_n where name = ?;xyz", 43);
+                PreparedStatement_setString(p, 1, "100%s");
+                r = PreparedStatement_executeQuery(p);
+                assert(ResultSet_next(r));
+                assert(ResultSet_getInt(r, 1) == 1);
+                Connection_close(con);
+                con = ConnectionPool_getConnection(pool);
+                Connection_execute_n(con, "drop table zild_n;", 18);
+                Connection_close(con);
+                ConnectionPool_free(&pool);
+                assert(pool==NULL);
+                URL_free(&url);
+        }
+        printf("=> Test27: OK\n\n");
+
+        printf("=> Test28: Batch execute\n");
+        {
+                url = URL_new(testURL);
+                pool = ConnectionPool_new(url);
+                assert(pool);
+                ConnectionPool_setInitialConnections(pool, 1);
+                ConnectionPool_start(pool);
+                Connection_T con = ConnectionPool_getConnection(pool);
+                assert(con);
+                TRY Connection_execute(con, "drop table zild_b;"); ELSE END_TRY;
+                Connection_execute(con, "create table zild_b (id integer primary key, name varchar(255));");
+                PreparedStatement_T p = Connection_prepareStatement(con, "insert into zild_b values (?, ?);");
+                char name[STRLEN];
+                for (int i = 1; i <= 1000; i++) {
+                        // The buffer is reused for each row, addBatch copies the value
+                        snprintf(name, sizeof(name), "name %d", i);
+                        PreparedStatement_setInt(p, 1, i);
+                        PreparedStatement_setString(p, 2, name);
+                        PreparedStatement_addBatch(p);
+                }
+                assert(PreparedStatement_getBatchSize(p) == 1000);
+                assert(PreparedStatement_executeBatch(p) == 1000);
+                assert(PreparedStatement_getBatchSize(p) == 0);
+                assert(PreparedStatement_getBatchRowsChanged(p, 1000) == 1);
+                assert(PreparedStatement_getBatchError(p, 1) == NULL);
+                ResultSet_T r = Connection_executeQuery(con, "select count(*), max(name) from zild_b where name like 'name %%';");
+                assert(ResultSet_next(r));
+                assert(ResultSet_getInt(r, 1) == 1000);
+                assert(Str_isEqual(ResultSet_getString(r, 2), "name 999"));
+                // Parameters not set in a row are NULL
+                PreparedStatement_T q = Connection_prepareStatement(con, "insert into zild_b values (?, ?);");
+                PreparedStatement_setInt(q, 1, 1001);
+                PreparedStatement_addBatch(q);
+                assert(PreparedStatement_executeBatch(q) == 1);
+                r = Connection_executeQuery(con, "select count(*) from zild_b where name is null;");
+                assert(ResultSet_next(r));
+                assert(ResultSet_getInt(r, 1) == 1);
+                // A duplicate key fails its row and is reported after the batch. PostgreSQL stops the batch at the failed row
+                if (! Str_startsWith(testURL, "postgresql")) {
+                        PreparedStatement_setInt(p, 1, 1002);
+                        PreparedStatement_setString(p, 2, "a");
+                        PreparedStatement_addBatch(p);
+                        PreparedStatement_setInt(p, 1, 1);
+                        PreparedStatement_addBatch(p);
+                        PreparedStatement_setInt(p, 1, 1003);
+                        PreparedStatement_addBatch(p);
+                        TRY
+                        {
+                                PreparedStatement_executeBatch(p);
+                                assert(false);
+                        }
+                        CATCH(SQLException)
+                        {
+                                assert(PreparedStatement_getBatchRowsChanged(p, 1) == 1);
+                                assert(PreparedStatement_getBatchRowsChanged(p, 2) == -1);
+                                assert(PreparedStatement_getBatchError(p, 2));
+                                assert(PreparedStatement_getBatchRowsChanged(p, 3) == 1);
+                        }
+                        END_TRY;
+                        r = Connection_executeQuery(con, "select count(*) from zild_b;");
+                        assert(ResultSet_next(r));
+                        assert(ResultSet_getInt(r, 1) == 1003);
+                }
+                Connection_execute(con, "drop table zild_b;");
+                Connection_close(con);
+                ConnectionPool_free(&pool);
+                assert(pool==NULL);
+                URL_free(&url);
+        }
+        printf("=> Test28: OK\n\n");
+
+        printf("=> Test29: Adaptive sizing with minimum idle connections\n");
+        {
+                PoolStatistics_T before, after;
+                url = URL_new(testURL);
+                pool = ConnectionPool_new(url);
+                assert(pool);
+                ConnectionPool_setInitialConnections(pool, 1);
+                ConnectionPool_setMaxConnections(pool, 10);
+                ConnectionPool_setMinIdle(pool, 3);
+                ConnectionPool_setAdaptiveSizing(pool, true);
+                ConnectionPool_start(pool);
+                for (int i = 0; i < 50 && ConnectionPool_size(pool) < 3; i++)
+                        usleep(100000);
+                Connection_T con = ConnectionPool_getConnection(pool);
+                Connection_close(con);
+                for (int i = 0; i < 50 && ConnectionPool_size(pool) < 4; i++)
+                        usleep(100000);
+                ConnectionPool_getStatistics(pool, &before);
+                printf("Please wait 6 sec for the sizing controller..");
+                fflush(stdout);
+                // A steady load below the minIdle watermark
+                for (int i = 0; i < (SQL_DEFAULT_ADAPT_INTERVAL + 1) * 10; i++) {
+                        con = ConnectionPool_getConnection(pool);
+                        assert(con);
+                        usleep(100000);
+                        Connection_close(con);
+                }
+                // The controller does not close idle connections the reaper has to open again
+                ConnectionPool_getStatistics(pool, &after);
+                assert(after.reaped == before.reaped);
+                assert(after.creations == before.creations);
+                assert(ConnectionPool_getTargetSize(pool) >= 4);
+                printf("success\n");
+                ConnectionPool_stop(pool);
+                ConnectionPool_free(&pool);
+                assert(pool==NULL);
+                URL_free(&url);
+        }
+        printf("=> Test29: OK\n\n");
+
+        printf("=> Test30: Validation policies\n");
+        {
+                // SQLite keeps the error of a failed statement until the next statement, such as a ping, is run
+                bool sqlite = Str_startsWith(testURL, "sqlite");
+                Validation_T policies[] = {Validation_onCheckout, Validation_onReturn, Validation_background};
+                for (int i = 0; i < 3; i++) {
+                        url = URL_new(testURL);
+                        pool = ConnectionPool_new(url);
+                        assert(pool);
+                        ConnectionPool_setInitialConnections(pool, 1);
+                        ConnectionPool_setMaxConnections(pool, 1);
+                        ConnectionPool_setValidation(pool, policies[i]);
+                        assert(ConnectionPool_getValidation(pool) == policies[i]);
+                        ConnectionPool_setValidationWindow(pool, 1000);
+                        assert(ConnectionPool_getValidationWindow(pool) == 1000);
+                        ConnectionPool_start(pool);
+                        Connection_T con = ConnectionPool_getConnection(pool);
+                        assert(con);
+                        TRY Connection_execute(con, "select * from zild_none;"); ELSE END_TRY;
+                        Connection_close(con);
+                        if (policies[i] == Validation_background)
+                                assert(ConnectionPool_reapConnections(pool) == 0);
+                        con = ConnectionPool_getConnection(pool);
+                        assert(con);
+                        if (sqlite) {
+                                // An embedded database is never pinged on checkout
+                                bool pinged = Str_isEqual(Connection_getLastError(con), "not an error");
+                                assert(pinged == (policies[i] != Validation_onCheckout));
+                        }
+                        Connection_close(con);
+                        ConnectionPool_free(&pool);
+                        assert(pool==NULL);
+                        URL_free(&url);
+                }
+        }
+        printf("=> Test30: OK\n\n");
+
+        printf("=> Test31: Lazy session state\n");
+        if (Str_startsWith(testURL, "sqlite") || Str_startsWith(testURL, "postgresql")) {
+                bool sqlite = Str_startsWith(testURL, "sqlite");
+                const char *reset = sqlite ? "pragma busy_timeout = 100;" : "set statement_timeout to 100;";
+                url = URL_new(testURL);
+                pool = ConnectionPool_new(url);
+                assert(pool);
+                ConnectionPool_start(pool);
+                Connection_T con = ConnectionPool_getConnection(pool);
+                assert(con);
+                // The timeout is sent before the next statement
+                Connection_setQueryTimeout(con, 2000);
+                assert(getSessionTimeout(con, sqlite) == 2000);
+                // An unchanged timeout is not sent again, nor is a change which is undone before a statement
+                Connection_execute(con, "%s", reset);
+                assert(getSessionTimeout(con, sqlite) == 100);
+                Connection_setQueryTimeout(con, 3000);
+                Connection_setQueryTimeout(con, 2000);
+                assert(getSessionTimeout(con, sqlite) == 100);
+                // A rollback may undo a timeout set in the transaction, so it is sent again even if unchanged
+                Connection_beginTransaction(con);
+                Connection_setQueryTimeout(con, 4000);
+                assert(getSessionTimeout(con, sqlite) == 4000);
+                Connection_execute(con, "%s", reset);
+                Connection_rollback(con); // Also resets the connection properties
+                Connection_setQueryTimeout(con, 4000);
+                assert(getSessionTimeout(con, sqlite) == 4000);
+                Connection_close(con);
+                ConnectionPool_free(&pool);
+                assert(pool==NULL);
+                URL_free(&url);
+        }
+        printf("=> Test31: OK\n\n");
+
+        printf("=> Test32: Concurrent checkout and return\n");
+        {
+                url = URL_new(testURL);
+                pool = ConnectionPool_new(url);
+                assert(pool);
+                ConnectionPool_setInitialConnections(pool, 4);
+                ConnectionPool_setMaxConnections(pool, 8);
+                ConnectionPool_setShards(pool, 4);
+                ConnectionPool_start(pool);
+                PoolStatistics_T before, after;
+                ConnectionPool_getStatistics(pool, &before);
+                assert(before.size == 4);
+                assert(before.creations == 4);
+                Thread_T threads[16];
+                for (int i = 0; i < 16; i++)
+                        Thread_create(threads[i], checkoutAndReturn, pool);
+                for (int i = 0; i < 16; i++)
+                        Thread_join(threads[i]);
+                ConnectionPool_getStatistics(pool, &after);
+                assert(after.checkouts - before.checkouts == 16 * 500);
+                assert(after.returns - before.returns == 16 * 500);
+                assert(after.active == 0);
+                assert(after.waiting == 0);
+                assert(after.size >= 4 && after.size <= 8);
+                assert(after.size == after.creations - after.reaped);
+                // Every connection is idle and can be checked out again without opening a new one
+                Connection_T connections[8];
+                for (int i = 0; i < after.size; i++) {
+                        connections[i] = ConnectionPool_getConnection(pool);
+                        assert(connections[i]);
+                }
+                ConnectionPool_getStatistics(pool, &before);
+                assert(before.active == after.size);
+                assert(before.creations == after.creations);
+                for (int i = 0; i < after.size; i++)
+                        Connection_close(connections[i]);
+                assert(ConnectionPool_active(pool) == 0);
+                assert(ConnectionPool_size(pool) == after.size);
+                ConnectionPool_free(&pool);
+                assert(pool==NULL);
+                URL_free(&url);
+        }
+        printf("=> Test32: OK\n\n");
+
+        printf("=> Test33: Most recently returned connection first\n");
+        {
+                url = URL_new(testURL);
+                pool = ConnectionPool_new(url);
+                assert(pool);
+                ConnectionPool_setInitialConnections(pool, 3);
+                ConnectionPool_setMaxConnections(pool, 3);
+                ConnectionPool_start(pool);
+                Connection_T a = ConnectionPool_getConnection(pool);
+                Connection_T b = ConnectionPool_getConnection(pool);
+                Connection_T c = ConnectionPool_getConnection(pool);
+                assert(a && b && c);
+                Connection_close(a);
+                Connection_close(b);
+                Connection_close(c);
+                // Idle connections are handed out last in, first out
+                assert(ConnectionPool_getConnection(pool) == c);
+                assert(ConnectionPool_getConnection(pool) == b);
+                assert(ConnectionPool_getConnection(pool) == a);
+                Connection_close(b);
+                Connection_close(a);
+                Connection_close(c);
+                assert(ConnectionPool_getConnection(pool) == c);
+                Connection_close(c);
+                ConnectionPool_free(&pool);
+                assert(pool==NULL);
+                URL_free(&url);
+        }
+        printf("=> Test33: OK\n\n");
+
 
         printf("============> Connection Pool Tests: OK\n\n");
 }
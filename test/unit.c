@@ -3,6 +3,8 @@
 #include <string.h>
 #include <fcntl.h>
 #include <stdlib.h>
+#include <unistd.h>
+#include <sys/socket.h>
 
 #include "Config.h"
 #include "URL.h"
@@ -367,6 +369,25 @@ static void testSystem() {
                 assert(System_getError(errno));
         }
         printf("=> Test3: OK\n\n");
+
+        printf("=> Test4: isSocketAlive\n");
+        {
+                int fds[2];
+                char c;
+                assert(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0);
+                assert(System_isSocketAlive(fds[0]));
+                // Pending data on an idle connection is suspicious
+                assert(write(fds[1], "x", 1) == 1);
+                assert(! System_isSocketAlive(fds[0]));
+                assert(read(fds[0], &c, 1) == 1);
+                assert(System_isSocketAlive(fds[0]));
+                // Peer closed the connection
+                close(fds[1]);
+                assert(! System_isSocketAlive(fds[0]));
+                close(fds[0]);
+                assert(! System_isSocketAlive(-1));
+        }
+        printf("=> Test4: OK\n\n");
         
         printf("============> System Tests: OK\n\n");
 }